@@ -0,0 +1,272 @@
+// Copyright (c) 2020 Can Boluk
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+#include <span>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "../img_common.hpp"
+#include "image.hpp"
+
+namespace win
+{
+	// Register context of a sample, indexed by the unwind register identifiers.
+	//
+	struct amd64_context_t
+	{
+		uint64_t                    gp[ 24 ] = {};       // GP registers and the fake entries (flags, rip, ss, cs).
+		xmm_t                       xmm[ 16 ] = {};      // XMM registers.
+
+		void* resolve( unwind_register_id reg )
+		{
+			if ( reg >= unwind_register_id::amd64_xmm0 )
+				return &xmm[ ( size_t( reg ) - size_t( unwind_register_id::amd64_xmm0 ) ) & 15 ];
+			return &gp[ size_t( reg ) ];
+		}
+		uint64_t& sp() { return gp[ size_t( unwind_register_id::amd64_rsp ) ]; }
+		uint64_t& ip() { return gp[ size_t( unwind_register_id::amd64_rip ) ]; }
+	};
+
+	// Profiler sample, register context and the stack snapshot taken with it.
+	//
+	struct amd64_unwind_sample_t
+	{
+		amd64_context_t             context = {};
+		uint64_t                    stack_address = 0;   // Address of the first byte in the snapshot, usually RSP at the time of sampling.
+		const uint8_t*              stack = nullptr;     // Snapshot of the stack.
+		size_t                      stack_size = 0;      //
+	};
+
+	// Set of modules, sorted by the image base.
+	//
+	struct amd64_module_set_t
+	{
+		std::vector<amd64_unwind_module_t> modules;
+
+		// Inserts a module.
+		//
+		void insert( const amd64_unwind_module_t& module )
+		{
+			auto it = std::upper_bound( modules.begin(), modules.end(), module.image_base, [ ] ( uint64_t va, const auto& m ) { return va < m.image_base; } );
+			modules.insert( it, module );
+		}
+
+		// Inserts a mapped image.
+		//
+		void insert( const image_t<true>* image, uint64_t image_base, size_t image_size = 0 )
+		{
+			amd64_unwind_module_t module = {
+				.image_base = image_base,
+				.image_size = image_size ? image_size : image->get_nt_headers()->optional_header.size_image,
+				.mapped = ( const uint8_t* ) image
+			};
+			if ( auto dir = image->get_directory( directory_entry_exception ) )
+				if ( auto table = module.rva_to_ptr( dir->rva, dir->size ) )
+					module.functions = { table, dir->size };
+			insert( module );
+		}
+
+		// Finds the module containing the given address.
+		//
+		const amd64_unwind_module_t* find( uint64_t va ) const
+		{
+			auto it = std::upper_bound( modules.begin(), modules.end(), va, [ ] ( uint64_t va, const auto& m ) { return va < m.image_base; } );
+			if ( it == modules.begin() ) return nullptr;
+			--it;
+			return it->contains( va ) ? &*it : nullptr;
+		}
+	};
+
+	// Result of a batch unwind, fixed stride of instruction pointers per sample.
+	//
+	struct amd64_unwind_batch_t
+	{
+		size_t                      max_depth = 0;
+		std::vector<uint64_t>       frames;
+		std::vector<uint32_t>       depths;
+
+		size_t size() const { return depths.size(); }
+		std::span<const uint64_t> trace( size_t n ) const { return { frames.data() + n * max_depth, depths[ n ] }; }
+	};
+
+	// Accessor reading from the stack snapshot of a sample first and the mapped modules otherwise.
+	//
+	struct amd64_snapshot_accessor_t
+	{
+		amd64_context_t*            context = nullptr;
+		const amd64_unwind_sample_t* sample = nullptr;
+		const amd64_module_set_t*   modules = nullptr;
+
+		void* resolve_reg( unwind_register_id reg ) const { return context->resolve( reg ); }
+		bool read( void* dst, uint64_t src, size_t n ) const
+		{
+			if ( sample->stack_address <= src && n <= sample->stack_size && ( src - sample->stack_address ) <= ( sample->stack_size - n ) )
+			{
+				memcpy( dst, sample->stack + ( src - sample->stack_address ), n );
+				return true;
+			}
+			if ( auto* module = modules->find( src ) )
+			{
+				if ( auto* ptr = module->rva_to_ptr( uint32_t( src - module->image_base ), n ) )
+				{
+					memcpy( dst, ptr, n );
+					return true;
+				}
+			}
+			return false;
+		}
+		bool write( uint64_t, const void*, size_t ) const { return false; }
+	};
+	using amd64_snapshot_unwind_state_t = amd64_unwind_accessor_state_t<amd64_snapshot_accessor_t>;
+
+	namespace impl
+	{
+		// Direct mapped cache of function lookups along with their decoded unwind chains, shared by the samples
+		// processed by a single worker.
+		// - Chains are memoized per module by the resolvers, so functions sharing a chained parent reuse it even
+		//   after their lookups are evicted.
+		//
+		struct amd64_function_cache_t
+		{
+			struct entry_t
+			{
+				uint64_t                    ip = 0;
+				const amd64_unwind_module_t* module = nullptr;
+				const runtime_function_t*   function = nullptr;
+				const unwind_chain_resolver_t::chain_t* chain = nullptr;
+			};
+			entry_t                     entries[ 256 ] = {};
+			const amd64_module_set_t*   modules;
+			bool                        resolve_chains = true;
+			std::unordered_map<const amd64_unwind_module_t*, unwind_chain_resolver_t> resolvers = {};
+
+			const entry_t& lookup( uint64_t ip )
+			{
+				entry_t& entry = entries[ ( ip ^ ( ip >> 8 ) ) & 0xFF ];
+				if ( entry.ip == ip && entry.module )
+					return entry;
+
+				entry = { .ip = ip, .module = modules->find( ip ) };
+				if ( entry.module )
+				{
+					auto it = entry.module->functions.find_overlapping( uint32_t( ip - entry.module->image_base ) );
+					if ( it != entry.module->functions.end() )
+					{
+						entry.function = it;
+						if ( resolve_chains )
+						{
+							auto& resolver = resolvers.try_emplace( entry.module, unwind_chain_resolver_t{ .module = entry.module } ).first->second;
+							entry.chain = &resolver.resolve( it->rva_unwind_info );
+						}
+					}
+				}
+				return entry;
+			}
+		};
+
+		static void amd64_unwind_sample( const amd64_unwind_sample_t& sample, amd64_function_cache_t& cache, uint64_t* frames, uint32_t& depth, size_t max_depth )
+		{
+			amd64_context_t context = sample.context;
+			amd64_snapshot_unwind_state_t state = { .accessor = { .context = &context, .sample = &sample, .modules = cache.modules } };
+
+			depth = 0;
+			while ( depth != max_depth )
+			{
+				uint64_t ip = context.ip();
+				uint64_t sp = context.sp();
+				if ( !ip ) break;
+				frames[ depth++ ] = ip;
+
+				// Unwind the frame, stop if the stack did not move forward.
+				//
+				auto& entry = cache.lookup( ip );
+				bool unwound = entry.chain
+					? amd64_unwind_frame( state, entry.module, entry.function, *entry.chain )
+					: amd64_unwind_frame( state, entry.module, entry.function );
+				if ( !unwound || context.sp() <= sp )
+					break;
+			}
+		}
+	};
+
+	// Unwinds a batch of samples against a module set.
+	// - Samples are grouped by the function they start in for better locality and then split across the workers.
+	// - Number of threads defaults to the hardware concurrency.
+	//
+	static amd64_unwind_batch_t amd64_unwind_samples( std::span<const amd64_unwind_sample_t> samples, const amd64_module_set_t& modules, size_t max_depth = 64, size_t num_threads = 0 )
+	{
+		amd64_unwind_batch_t result;
+		result.max_depth = max_depth;
+		result.frames.resize( samples.size() * max_depth );
+		result.depths.resize( samples.size() );
+		if ( samples.empty() || !max_depth )
+			return result;
+
+		// Group the samples by the module and function of the leaf frame.
+		//
+		std::vector<std::pair<uint64_t, uint32_t>> order( samples.size() );
+		{
+			impl::amd64_function_cache_t cache = { .modules = &modules, .resolve_chains = false };
+			for ( size_t n = 0; n != samples.size(); n++ )
+			{
+				uint64_t ip = samples[ n ].context.gp[ size_t( unwind_register_id::amd64_rip ) ];
+				auto& entry = cache.lookup( ip );
+				uint64_t key = entry.function ? entry.module->image_base + entry.function->rva_begin : ip;
+				order[ n ] = { key, ( uint32_t ) n };
+			}
+			std::sort( order.begin(), order.end() );
+		}
+
+		// Split into contiguous ranges and fan out.
+		//
+		auto worker = [ & ] ( size_t begin, size_t end )
+		{
+			impl::amd64_function_cache_t cache = { .modules = &modules };
+			for ( size_t n = begin; n != end; n++ )
+			{
+				uint32_t idx = order[ n ].second;
+				impl::amd64_unwind_sample( samples[ idx ], cache, &result.frames[ idx * max_depth ], result.depths[ idx ], max_depth );
+			}
+		};
+		if ( !num_threads )
+			num_threads = std::max<size_t>( std::thread::hardware_concurrency(), 1 );
+		num_threads = std::clamp<size_t>( samples.size() / 64, 1, num_threads );
+
+		size_t chunk = ( samples.size() + num_threads - 1 ) / num_threads;
+		std::vector<std::thread> threads;
+		for ( size_t n = 1; n < num_threads; n++ )
+			threads.emplace_back( worker, std::min( n * chunk, samples.size() ), std::min( ( n + 1 ) * chunk, samples.size() ) );
+		worker( 0, std::min( chunk, samples.size() ) );
+		for ( auto& thread : threads )
+			thread.join();
+		return result;
+	}
+};
@@ -0,0 +1,124 @@
+// Copyright (c) 2020 Can Boluk
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <algorithm>
+#include <optional>
+#include <vector>
+#include "../img_common.hpp"
+#include "image.hpp"
+#include "sha.hpp"
+
+namespace win
+{
+	// Enumerates the ranges of the headers covered by the Authenticode digest as fn( offset, length ), skipping the
+	// checksum and the security directory entry; returns false if the headers do not fit the file.
+	//
+	template<bool x64, typename F>
+	inline bool for_each_authenticode_header_range( const image_t<x64>* image, size_t file_size, F&& fn )
+	{
+		auto* base = ( const uint8_t* ) image;
+		auto* nt_hdrs = image->get_nt_headers();
+		size_t size_headers = nt_hdrs->optional_header.size_headers;
+		if ( size_headers > file_size )
+			return false;
+
+		size_t checksum = ( const uint8_t* ) &nt_hdrs->optional_header.checksum - base;
+		size_t security = size_headers;
+		if ( nt_hdrs->optional_header.num_data_directories > directory_entry_security )
+			security = ( const uint8_t* ) &nt_hdrs->optional_header.data_directories.entries[ directory_entry_security ] - base;
+		if ( ( checksum + sizeof( uint32_t ) ) > security || ( security != size_headers && ( security + sizeof( data_directory_t ) ) > size_headers ) )
+			return false;
+		fn( size_t( 0 ), checksum );
+		fn( checksum + sizeof( uint32_t ), security - checksum - sizeof( uint32_t ) );
+		if ( security != size_headers )
+			fn( security + sizeof( data_directory_t ), size_headers - security - sizeof( data_directory_t ) );
+		return true;
+	}
+
+	// Enumerates the file ranges covered by the Authenticode digest in hashing order as fn( offset, length ).
+	// - Headers without the checksum and the security directory entry, sections in file order, then any
+	//   trailing data except for the certificate table.
+	// - Returns false if the headers, sections or the certificate table do not fit the file.
+	//
+	template<bool x64, typename F>
+	inline bool for_each_authenticode_range( const image_t<x64>* image, size_t file_size, F&& fn )
+	{
+		if ( !for_each_authenticode_header_range( image, file_size, fn ) )
+			return false;
+		auto* nt_hdrs = image->get_nt_headers();
+		size_t size_headers = nt_hdrs->optional_header.size_headers;
+
+		// Sections in the order of their raw data.
+		//
+		size_t num_sections = nt_hdrs->file_header.num_sections;
+		std::vector<const section_header_t*> sections( num_sections );
+		for ( size_t i = 0; i != num_sections; i++ )
+			sections[ i ] = nt_hdrs->get_section( i );
+		std::stable_sort( sections.begin(), sections.end(), [ ] ( auto* a, auto* b ) { return a->ptr_raw_data < b->ptr_raw_data; } );
+
+		size_t end = size_headers;
+		for ( auto* scn : sections )
+		{
+			if ( !scn->size_raw_data )
+				continue;
+			if ( scn->ptr_raw_data > file_size || scn->size_raw_data > ( file_size - scn->ptr_raw_data ) )
+				return false;
+			fn( size_t( scn->ptr_raw_data ), size_t( scn->size_raw_data ) );
+			end = std::max<size_t>( end, scn->ptr_raw_data + scn->size_raw_data );
+		}
+
+		// Trailing data around the certificate table, whose directory entry holds a file offset.
+		//
+		size_t cert_begin = file_size, cert_end = file_size;
+		if ( auto* dir = image->get_directory( directory_entry_security ) )
+		{
+			if ( dir->rva > file_size || dir->size > ( file_size - dir->rva ) )
+				return false;
+			cert_begin = dir->rva;
+			cert_end = size_t( dir->rva ) + dir->size;
+		}
+		if ( cert_begin > end )
+			fn( end, cert_begin - end );
+		end = std::max( end, cert_end );
+		if ( file_size > end )
+			fn( end, file_size - end );
+		return true;
+	}
+
+	// Computes the Authenticode digest of a raw image, std::nullopt if malformed.
+	//
+	template<typename H = sha256_t, bool x64>
+	inline std::optional<typename H::digest_t> authenticode_digest( const image_t<x64>* image, size_t file_size )
+	{
+		H hasher;
+		auto* base = ( const uint8_t* ) image;
+		if ( !for_each_authenticode_range( image, file_size, [ & ] ( size_t offset, size_t length ) { hasher.update( base + offset, length ); } ) )
+			return std::nullopt;
+		return hasher.finalize();
+	}
+};
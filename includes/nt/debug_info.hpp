@@ -0,0 +1,196 @@
+// Copyright (c) 2020 Can Boluk
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <algorithm>
+#include <span>
+#include <string_view>
+#include <vector>
+#include "../img_common.hpp"
+#include "directories/dir_debug.hpp"
+#include "image.hpp"
+
+namespace win
+{
+	namespace impl
+	{
+		// Resolves a range of the view, nullptr if any of it is outside.
+		// - Mapped views are additionally bounded by the image size.
+		//
+		template<typename T, bool x64>
+		inline const T* debug_rva_to_ptr( const image_t<x64>* image, uint32_t rva, size_t length, size_t view_size, bool mapped )
+		{
+			if ( mapped )
+			{
+				size_t limit = std::min<size_t>( view_size, image->get_nt_headers()->optional_header.size_image );
+				if ( rva > limit || length > ( limit - rva ) )
+					return nullptr;
+				return image->template raw_to_ptr<T>( rva );
+			}
+			auto* ptr = image->template rva_to_ptr<T>( rva, length );
+			if ( !ptr || ( size_t( image->ptr_to_raw( ptr ) ) + length ) > view_size )
+				return nullptr;
+			return ptr;
+		}
+		template<typename T, bool x64>
+		inline const T* debug_fo_to_ptr( const image_t<x64>* image, uint32_t offset, size_t length, size_t view_size )
+		{
+			if ( offset > view_size || length > ( view_size - offset ) )
+				return nullptr;
+			return image->template raw_to_ptr<T>( offset );
+		}
+	};
+
+	// Range over the debug directory entries.
+	// - Mapped views translate RVAs directly, raw views through the section table.
+	// - View size is the number of bytes readable at the image: the file size of raw views, the mapped size otherwise.
+	//
+	template<bool x64>
+	inline std::span<const debug_directory_entry_t> debug_entries( const image_t<x64>* image, size_t view_size, bool mapped = false )
+	{
+		auto* dir = image->get_directory( directory_entry_debug );
+		if ( !dir )
+			return {};
+		size_t count = dir->size / sizeof( debug_directory_entry_t );
+		auto* entries = impl::debug_rva_to_ptr<debug_directory_entry_t>( image, dir->rva, count * sizeof( debug_directory_entry_t ), view_size, mapped );
+		if ( !entries )
+			return {};
+		return { entries, count };
+	}
+
+	// Data referenced by a debug entry, empty if not present or not entirely within the view.
+	// - Raw views prefer the file offset as the data is not necessarily part of a section.
+	//
+	template<bool x64>
+	inline std::span<const uint8_t> debug_data( const image_t<x64>* image, const debug_directory_entry_t& entry, size_t view_size, bool mapped = false )
+	{
+		if ( !entry.size_raw_data )
+			return {};
+		const uint8_t* data;
+		if ( mapped )
+			data = entry.rva_raw_data ? impl::debug_rva_to_ptr<uint8_t>( image, entry.rva_raw_data, entry.size_raw_data, view_size, true ) : nullptr;
+		else if ( entry.ptr_raw_data )
+			data = impl::debug_fo_to_ptr<uint8_t>( image, entry.ptr_raw_data, entry.size_raw_data, view_size );
+		else
+			data = impl::debug_rva_to_ptr<uint8_t>( image, entry.rva_raw_data, entry.size_raw_data, view_size, false );
+		if ( !data )
+			return {};
+		return { data, entry.size_raw_data };
+	}
+
+	// Data of the first debug entry of the given type, empty if not present.
+	//
+	template<bool x64>
+	inline std::span<const uint8_t> find_debug_record( const image_t<x64>* image, debug_directory_type_id type, size_t view_size, bool mapped = false )
+	{
+		for ( auto& entry : debug_entries( image, view_size, mapped ) )
+		{
+			if ( entry.type != type )
+				continue;
+			if ( auto data = debug_data( image, entry, view_size, mapped ); !data.empty() )
+				return data;
+		}
+		return {};
+	}
+	template<bool x64> inline repro_view_t find_repro( const image_t<x64>* image, size_t view_size, bool mapped = false )
+	{
+		auto record = find_debug_record( image, debug_directory_type_id::repro, view_size, mapped );
+		return { record.data(), record.size() };
+	}
+	template<bool x64> inline pogo_view_t find_pogo( const image_t<x64>* image, size_t view_size, bool mapped = false )
+	{
+		auto record = find_debug_record( image, debug_directory_type_id::pogo, view_size, mapped );
+		return { record.data(), record.size() };
+	}
+
+	// First PDB 7.0 CodeView record and its size.
+	//
+	template<bool x64>
+	inline std::pair<const cv_pdb70_t*, size_t> find_pdb70( const image_t<x64>* image, size_t view_size, bool mapped = false )
+	{
+		for ( auto& entry : debug_entries( image, view_size, mapped ) )
+		{
+			if ( entry.type != debug_directory_type_id::codeview || entry.size_raw_data < sizeof( cv_pdb70_t ) )
+				continue;
+			auto data = debug_data( image, entry, view_size, mapped );
+			auto* cv = ( const cv_pdb70_t* ) data.data();
+			if ( cv && cv->signature == cv_signature::pdb70 )
+				return { cv, data.size() };
+		}
+		return { nullptr, 0 };
+	}
+
+	// Contiguous table of (PDB name, symbol server key) pairs extracted from many images.
+	// - Images without a PDB 7.0 record get a row with an empty key and name.
+	//
+	struct pdb_identity_table_t
+	{
+		struct row_t
+		{
+			cv_pdb_key_t            key;
+			uint32_t                name_offset;
+			uint32_t                name_length;
+		};
+
+		std::vector<row_t>          rows = {};
+		std::vector<char>           names = {};   // Concatenated names, not terminated.
+
+		inline size_t size() const { return rows.size(); }
+		inline bool has_pdb( size_t n ) const { return rows[ n ].key.length != 0; }
+		inline std::string_view key( size_t n ) const { return rows[ n ].key.view(); }
+		inline std::string_view name( size_t n ) const { return { names.data() + rows[ n ].name_offset, rows[ n ].name_length }; }
+
+		// Appends a row per image, view sizes are given in the same order as the images.
+		//
+		template<bool x64>
+		void append( std::span<const image_t<x64>* const> images, std::span<const size_t> view_sizes, bool mapped = false )
+		{
+			rows.reserve( rows.size() + images.size() );
+			for ( size_t n = 0; n != images.size(); n++ )
+			{
+				row_t& row = rows.emplace_back();
+				row.name_offset = uint32_t( names.size() );
+				if ( n >= view_sizes.size() )
+					continue;
+				auto [ cv, size ] = find_pdb70( images[ n ], view_sizes[ n ], mapped );
+				if ( !cv )
+					continue;
+				row.key = cv->key();
+				auto name = cv->name( size );
+				names.insert( names.end(), name.begin(), name.end() );
+				row.name_length = uint32_t( name.size() );
+			}
+		}
+		template<bool x64>
+		static pdb_identity_table_t extract( std::span<const image_t<x64>* const> images, std::span<const size_t> view_sizes, bool mapped = false )
+		{
+			pdb_identity_table_t table = {};
+			table.append( images, view_sizes, mapped );
+			return table;
+		}
+	};
+};
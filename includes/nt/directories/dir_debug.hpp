@@ -27,7 +27,12 @@
 //
 #pragma once
 #include <utility>
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <span>
 #include <string>
+#include <string_view>
 
 #include "../../img_common.hpp"
 #include "../data_directories.hpp"
@@ -91,6 +96,10 @@ namespace win
 		iltcg =         0x0000000E,
 		mpx =           0x0000000F,
 		repro =         0x00000010,
+		embedded_pdb =  0x00000011,
+		spgo =          0x00000012,
+		pdb_checksum =  0x00000013,
+		ex_dllcharacteristics = 0x00000014,
 	};
 
 	// Codeview headers
@@ -116,6 +125,15 @@ namespace win
 
 	};
 
+	// Fixed capacity symbol server key.
+	//
+	struct cv_pdb_key_t
+	{
+		char                        value[ 42 ];    // GUID and age, see cv_pdb70_t::format_to.
+		uint8_t                     length;
+		inline std::string_view view() const { return { value, length }; }
+	};
+
 	struct cv_pdb70_t : cv_header_t
 	{
 		guid_t                      guid;
@@ -123,13 +141,12 @@ namespace win
 		char                        pdb_name[ VAR_LEN ];
 
 		// Formats into the MSDL format.
+		// - format_to writes at most max_format_length characters without a terminator and returns the length.
 		//
-		inline std::string format() const
+		static constexpr size_t max_format_length = 8 + 8 + 16 + 10;
+		inline constexpr size_t format_to( char* out ) const
 		{
-			std::string result;
-			result.resize( 8 + 8 + 16 + 10 );
-
-			char* it = result.data();
+			char* it = out;
 			// u32 * 1 = 8 digits
 			impl::fmt_uhex_0pad( it, guid.dword );
 			// u16 * 2 = 8 digits
@@ -140,10 +157,31 @@ namespace win
 				impl::fmt_uhex_0pad( it, v );
 			// u32 dec = max 10 digits
 			impl::fmt_udec( it, age );
-
-			result.resize( it - result.data() );
+			return size_t( it - out );
+		}
+		inline cv_pdb_key_t key() const
+		{
+			cv_pdb_key_t result = {};
+			result.length = uint8_t( format_to( result.value ) );
 			return result;
 		}
+		inline std::string format() const
+		{
+			std::string result;
+			result.resize( max_format_length );
+			result.resize( format_to( result.data() ) );
+			return result;
+		}
+
+		// PDB name bounded by the size of the record.
+		//
+		inline std::string_view name( size_t record_size ) const
+		{
+			size_t offset = size_t( pdb_name - ( const char* ) this );
+			if ( record_size <= offset )
+				return {};
+			return { pdb_name, strnlen( pdb_name, record_size - offset ) };
+		}
 	};
 
 	// Misc headers
@@ -162,6 +200,67 @@ namespace win
 		uint8_t                     data[ VAR_LEN ];
 	};
 
+	// Repro headers, hash of the build inputs.
+	//
+	struct debug_repro_t
+	{
+		uint32_t                    length;
+		uint8_t                     hash[ VAR_LEN ];
+	};
+
+	// POGO headers, section contributions recorded by LTCG and profile guided builds.
+	//
+	enum class pogo_signature : uint32_t
+	{
+		ltcg =  0x4C544347, // 'LTCG'
+		pgi =   0x50474900, // 'PGI\0'
+		pgo =   0x50474F00, // 'PGO\0'
+		pgu =   0x50475500, // 'PGU\0'
+	};
+
+	struct pogo_entry_t
+	{
+		uint32_t                    rva;
+		uint32_t                    size;
+		char                        name[ VAR_LEN ];  // Null terminated, padded to 4 bytes.
+	};
+
+	struct debug_pogo_t
+	{
+		pogo_signature              signature;
+		pogo_entry_t                entries[ VAR_LEN ];
+	};
+
+	// Extended DLL characteristics.
+	//
+	enum ex_dll_characteristics_t : uint32_t
+	{
+		ex_dll_cet_compat =                             0x01,
+		ex_dll_cet_compat_strict_mode =                 0x02,
+		ex_dll_cet_set_context_ip_validation_relaxed =  0x04,
+		ex_dll_cet_dynamic_apis_allow_in_proc =         0x08,
+		ex_dll_cet_reserved_1 =                         0x10,
+		ex_dll_cet_reserved_2 =                         0x20,
+		ex_dll_forward_cfi_compat =                     0x40,
+		ex_dll_hotpatch_compatible =                    0x80,
+	};
+
+	struct debug_ex_dllcharacteristics_t
+	{
+		uint32_t                    flags;
+	};
+
+	// VC feature counters, number of objects built with each feature.
+	//
+	struct debug_vc_feature_t
+	{
+		uint32_t                    pre_vc11;
+		uint32_t                    c_cpp;
+		uint32_t                    gs;
+		uint32_t                    sdl;
+		uint32_t                    guard_n;
+	};
+
 	// Directory type.
 	//
 	struct debug_directory_entry_t
@@ -183,3 +282,86 @@ namespace win
 	template<bool x64> struct directory_type<directory_id::directory_entry_debug, x64, void> { using type = debug_directory_t; };
 };
 #pragma pack(pop)
+
+namespace win
+{
+	// Bounded views over the variable length debug records, constructed from the record and its size.
+	//
+	struct repro_view_t
+	{
+		const uint8_t*              data = nullptr;
+		size_t                      size = 0;
+
+		// Hash of the inputs, empty if the image is deterministic but carries no hash.
+		//
+		inline std::span<const uint8_t> hash() const
+		{
+			if ( size < sizeof( uint32_t ) )
+				return {};
+			auto* repro = ( const debug_repro_t* ) data;
+			return { repro->hash, std::min<size_t>( repro->length, size - sizeof( uint32_t ) ) };
+		}
+	};
+
+	struct pogo_view_t
+	{
+		const uint8_t*              data = nullptr;
+		size_t                      size = 0;
+
+		// Forward iterator over the records, stops at the first record crossing the end.
+		//
+		struct iterator
+		{
+			using iterator_category =   std::forward_iterator_tag;
+			using difference_type =     ptrdiff_t;
+			using value_type =          pogo_entry_t;
+			using pointer =             const pogo_entry_t*;
+			using reference =           const pogo_entry_t&;
+
+			const uint8_t*          at = nullptr;
+			const uint8_t*          end = nullptr;
+
+			// Record length including the padding, zero if malformed.
+			//
+			inline size_t length() const
+			{
+				size_t limit = size_t( end - at );
+				size_t name_offset = offsetof( pogo_entry_t, name );
+				if ( limit <= name_offset )
+					return 0;
+				size_t name_length = strnlen( ( const char* ) at + name_offset, limit - name_offset );
+				if ( name_length == ( limit - name_offset ) )
+					return 0;
+				return std::min( ( name_offset + name_length + 1 + 3 ) & ~size_t( 3 ), limit );
+			}
+			inline std::string_view name() const { return { ( ( const pogo_entry_t* ) at )->name }; }
+
+			inline iterator& operator++()
+			{
+				size_t n = length();
+				at = n ? at + n : end;
+				if ( at != end && !length() ) at = end;
+				return *this;
+			}
+			inline iterator operator++( int ) { auto s = *this; operator++(); return s; }
+			inline reference operator*() const { return *( const pogo_entry_t* ) at; }
+			inline pointer operator->() const { return ( const pogo_entry_t* ) at; }
+			inline bool operator==( const iterator& o ) const { return at == o.at; }
+			inline bool operator!=( const iterator& o ) const { return at != o.at; }
+		};
+
+		inline pogo_signature signature() const { return size >= sizeof( uint32_t ) ? ( ( const debug_pogo_t* ) data )->signature : pogo_signature{}; }
+		inline iterator begin() const
+		{
+			if ( size < sizeof( uint32_t ) )
+				return end();
+			iterator it = { data + sizeof( uint32_t ), data + size };
+			if ( !it.length() ) it.at = it.end;
+			return it;
+		}
+		inline iterator end() const { return { data + size, data + size }; }
+	};
+
+	inline const debug_ex_dllcharacteristics_t* as_ex_dllcharacteristics( const void* data, size_t size ) { return size >= sizeof( debug_ex_dllcharacteristics_t ) ? ( const debug_ex_dllcharacteristics_t* ) data : nullptr; }
+	inline const debug_vc_feature_t* as_vc_feature( const void* data, size_t size ) { return size >= sizeof( debug_vc_feature_t ) ? ( const debug_vc_feature_t* ) data : nullptr; }
+};
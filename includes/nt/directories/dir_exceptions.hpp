@@ -28,8 +28,13 @@
 #pragma once
 #include <algorithm>
 #include <array>
+#include <bit>
 #include <cstring>
 #include <map>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <vector>
 #include "../../img_common.hpp"
 #include "../data_directories.hpp"
 
@@ -48,7 +53,7 @@ namespace win
 		set_frame =                 0x3,   // no info, FP = RSP + UNWIND_INFO.FPRegOffset*16
 		save_nonvol =               0x4,   // info == register number, offset in next slot
 		save_nonvol_far =           0x5,   // info == register number, offset in next 2 slots
-		epilog =                    0x6,   // (?)
+		epilog =                    0x6,   // version 2 epilog descriptor, see amd64_enum_epilogs
 		spare_code =                0x7,   // (?)
 		save_xmm128 =               0x8,   // info == XMM reg number, offset in next slot
 		save_xmm128_far =           0x9,   // info == XMM reg number, offset in next 2 slots
@@ -119,6 +124,7 @@ namespace win
 	// Unwind code and info descriptors.
 	//
 	struct runtime_function_t;
+	struct c_scope_table_t;
 	struct unwind_code_t
 	{
 		union
@@ -167,6 +173,9 @@ namespace win
 		//
 		void* exception_specific_data() { return &exception_handler_rva() + 1; }
 		const void* exception_specific_data() const { return const_cast< unwind_info_t* >( this )->exception_specific_data(); }
+
+		c_scope_table_t* c_scope_table() { return ( c_scope_table_t* ) exception_specific_data(); }
+		const c_scope_table_t* c_scope_table() const { return const_cast< unwind_info_t* >( this )->c_scope_table(); }
 	};
 
 	// High level descriptors of the opcodes.
@@ -206,15 +215,16 @@ namespace win
 			uint64_t& ip() const { return gp( unwind_register_id::amd64_rip ); }
 			uint64_t& frame() const { return gp( frame_register ); }
 
-			template<typename T>
-			bool read( T& out, uint64_t address ) const
+			bool read_bytes( void* out, uint64_t address, size_t n ) const
 			{
-				if ( rmemcpy ) return rmemcpy( context, &out, address, sizeof( T ) );
+				if ( rmemcpy ) return rmemcpy( context, out, address, n );
 				if ( !address ) return false;
-				memcpy( &out, ( const void* ) address, sizeof( T ) );
+				memcpy( out, ( const void* ) address, n );
 				return true;
 			}
 			template<typename T>
+			bool read( T& out, uint64_t address ) const { return read_bytes( &out, address, sizeof( T ) ); }
+			template<typename T>
 			bool write( uint64_t address, const T& data ) const
 			{
 				if ( wmemcpy ) return wmemcpy( context, address, &data, sizeof( T ) );
@@ -227,17 +237,20 @@ namespace win
 		//bool unwind( const state_t& state ) const = 0;
 	};
 	using amd64_unwind_state_t = amd64_unwind_code_t::state_t;
+
 	struct amd64_unwind_set_frame_t : amd64_unwind_code_t
 	{
 		// Implement the interface.
 		//
 		size_t get_size() const { return 1; }
-		bool rewind( const state_t& state ) const
+		template<typename S = state_t>
+		bool rewind( const S& state ) const
 		{
 			state.frame() = state.sp() + ( size_t( state.frame_offset ) * 16 );
 			return true;
 		}
-		bool unwind( const state_t& state ) const
+		template<typename S = state_t>
+		bool unwind( const S& state ) const
 		{
 			state.sp() = state.frame() - ( size_t( state.frame_offset ) * 16 );
 			return true;
@@ -263,12 +276,14 @@ namespace win
 				return 1;
 			return op_info ? 3 : 2;
 		}
-		bool rewind( const state_t& state ) const
+		template<typename S = state_t>
+		bool rewind( const S& state ) const
 		{
 			state.sp() -= get_allocation_size();
 			return true;
 		}
-		bool unwind( const state_t& state ) const
+		template<typename S = state_t>
+		bool unwind( const S& state ) const
 		{
 			state.sp() += get_allocation_size();
 			return true;
@@ -283,14 +298,16 @@ namespace win
 		// Implement the interface.
 		//
 		size_t get_size() const { return 1; }
-		bool rewind( const state_t& state ) const
+		template<typename S = state_t>
+		bool rewind( const S& state ) const
 		{
 			if ( !state.write( state.sp() - 8, state.gp( get_register() ) ) )
 				return false;
 			state.sp() -= 8;
 			return true;
 		}
-		bool unwind( const state_t& state ) const
+		template<typename S = state_t>
+		bool unwind( const S& state ) const
 		{
 			if ( !state.read( state.gp( get_register() ), state.sp() ) )
 				return false;
@@ -314,11 +331,13 @@ namespace win
 		// Implement the interface.
 		//
 		size_t get_size() const { return unwind_op == unwind_opcode::save_nonvol_far ? 3 : 2; }
-		bool rewind( const state_t& state ) const
+		template<typename S = state_t>
+		bool rewind( const S& state ) const
 		{
 			return state.write( state.sp() + get_sp_offset(), state.gp( get_register() ) );
 		}
-		bool unwind( const state_t& state ) const
+		template<typename S = state_t>
+		bool unwind( const S& state ) const
 		{
 			return state.read( state.gp( get_register() ), state.sp() + get_sp_offset() );
 		}
@@ -339,11 +358,13 @@ namespace win
 		// Implement the interface.
 		//
 		size_t get_size() const { return unwind_op == unwind_opcode::save_xmm128_far ? 3 : 2; }
-		bool rewind( const state_t& state ) const
+		template<typename S = state_t>
+		bool rewind( const S& state ) const
 		{
 			return state.write( state.sp() + get_sp_offset(), state.xmm( get_register() ) );
 		}
-		bool unwind( const state_t& state ) const
+		template<typename S = state_t>
+		bool unwind( const S& state ) const
 		{
 			return state.read( state.xmm( get_register() ), state.sp() + get_sp_offset() );
 		}
@@ -357,11 +378,13 @@ namespace win
 		// Implement the interface.
 		//
 		size_t get_size() const { return 1; }
-		bool rewind( [[maybe_unused]] const state_t& state ) const
+		template<typename S = state_t>
+		bool rewind( [[maybe_unused]] const S& state ) const
 		{
 			return false;
 		}
-		bool unwind( const state_t& state ) const
+		template<typename S = state_t>
+		bool unwind( const S& state ) const
 		{
 			size_t offset = 0;
 			if ( has_exception_code() ) offset += 8;
@@ -380,13 +403,14 @@ namespace win
 	struct amd64_unwind_nop_t : amd64_unwind_code_t
 	{
 		size_t get_size() const { return 1; }
-		bool rewind( [[maybe_unused]] const state_t& state ) const { return true; }
-		bool unwind( [[maybe_unused]] const state_t& state ) const { return true; }
+		template<typename S = state_t> bool rewind( [[maybe_unused]] const S& state ) const { return true; }
+		template<typename S = state_t> bool unwind( [[maybe_unused]] const S& state ) const { return true; }
 	};
 
 	// Special unwind helper for unwinding after the function returns.
 	//
-	static bool amd64_unwind_call( const amd64_unwind_state_t& state )
+	template<typename S = amd64_unwind_state_t>
+	static bool amd64_unwind_call( const S& state )
 	{
 		// Read the return pointer.
 		//
@@ -394,11 +418,24 @@ namespace win
 			return false;
 		state.sp() += 8;
 
+		// Read the 16 bytes ending at the return address with a single read, if that fails
+		// retry with only the part within the page of the return address.
+		//
+		uint8_t bytes[ 16 ] = { 0 };
+		uint64_t region_begin = state.ip() - 15;
+		if ( state.ip() >= 15 && !state.read_bytes( bytes, region_begin, 16 ) )
+		{
+			memset( bytes, 0, sizeof( bytes ) );
+			uint64_t page_begin = state.ip() & ~0xFFFull;
+			if ( page_begin > region_begin && !state.read_bytes( bytes + ( page_begin - region_begin ), page_begin, size_t( state.ip() - page_begin + 1 ) ) )
+				memset( bytes, 0, sizeof( bytes ) );
+		}
+
 		// Basic attempt at decoding the instruction to unwind rip.
 		//
-		uint8_t call_region[ 16 ] = { 0 };
+		uint8_t call_region[ 16 ];
 		for ( size_t n = 0; n != 16; n++ )
-			state.read( call_region[ n ], state.ip() - n );
+			call_region[ n ] = bytes[ 15 - n ];
 
 		// call reg rel
 		if ( call_region[ 6 ] == 0xFF && ( call_region[ 7 ] & 0xF0 ) == 0x40 )
@@ -577,6 +614,857 @@ namespace win
 		{
 			return find( rva ) != end();
 		}
+
+		// Validates the ordering the lookups rely on in a single pass.
+		//
+		struct validation_t
+		{
+			bool                    sorted = true;        // Entries are ordered by both bounds.
+			bool                    overlapping = false;  // Entries overlap or are duplicated.
+			bool                    malformed = false;    // Entries are empty or inverted.
+			constexpr bool valid() const { return sorted && !overlapping && !malformed; }
+		};
+		constexpr validation_t validate() const
+		{
+			validation_t result = {};
+			for ( size_t n = 0; n != length; n++ )
+			{
+				auto& entry = table[ n ];
+				if ( entry.rva_begin >= entry.rva_end )
+					result.malformed = true;
+				if ( n == 0 )
+					continue;
+
+				auto& prev = table[ n - 1 ];
+				if ( entry.rva_begin < prev.rva_begin || entry.rva_end < prev.rva_end )
+					result.sorted = false;
+				else if ( entry.rva_begin < prev.rva_end )
+					result.overlapping = true;
+			}
+			return result;
+		}
 	};
 };
 #pragma pack(pop)
+
+// Lookup and unwinding state over the tables above, kept out of pack(4) so that containers of it
+// stay naturally aligned.
+//
+namespace win
+{
+	// Unwind state with the memory accessor resolved at compile-time, allows the unwinder to be inlined completely.
+	// - Implements the same interface as the callback based state, which remains the default instantiation.
+	// - Accessor should implement the following:
+	//    void* resolve_reg( unwind_register_id reg ) const;
+	//    bool  read( void* dst, uint64_t src, size_t n ) const;
+	//    bool  write( uint64_t dst, const void* src, size_t n ) const;
+	//
+	template<typename Accessor>
+	struct amd64_unwind_accessor_state_t
+	{
+		// Provided by the user.
+		//
+		uint8_t                 frame_offset = 0;      // Information from the function entry.
+		win::unwind_register_id frame_register = {};   //
+		Accessor                accessor = {};         // Memory and register accessor.
+
+		// Implement wrappers for some common operations.
+		//
+		uint64_t& gp( unwind_register_id gp_reg ) const { return *( uint64_t* ) accessor.resolve_reg( gp_reg ); }
+		xmm_t& xmm( unwind_register_id xmm_reg ) const { return *( xmm_t* ) accessor.resolve_reg( xmm_reg ); }
+		uint16_t& ss() const { return *( uint16_t* ) accessor.resolve_reg( unwind_register_id::amd64_seg_ss ); }
+		uint16_t& cs() const { return *( uint16_t* ) accessor.resolve_reg( unwind_register_id::amd64_seg_cs ); }
+		uint32_t& flags() const { return *( uint32_t* ) accessor.resolve_reg( unwind_register_id::amd64_eflags ); }
+
+		uint64_t& sp() const { return gp( unwind_register_id::amd64_rsp ); }
+		uint64_t& ip() const { return gp( unwind_register_id::amd64_rip ); }
+		uint64_t& frame() const { return gp( frame_register ); }
+
+		bool read_bytes( void* out, uint64_t address, size_t n ) const { return accessor.read( out, address, n ); }
+		template<typename T>
+		bool read( T& out, uint64_t address ) const { return accessor.read( &out, address, sizeof( T ) ); }
+		template<typename T>
+		bool write( uint64_t address, const T& data ) const { return accessor.write( address, &data, sizeof( T ) ); }
+	};
+
+	// Index over a C scope table answering which scopes cover an RVA, innermost first.
+	// - Scopes are sorted by their start and linked to the scope enclosing them.
+	// - If the scopes partially overlap, queries fall back to a linear scan in table order.
+	//
+	struct c_scope_index_t
+	{
+		struct node_t
+		{
+			uint32_t                    rva_begin;
+			uint32_t                    rva_end;
+			uint32_t                    parent;       // Index of the enclosing node or npos.
+			uint32_t                    entry;        // Index of the entry in the table.
+		};
+		static constexpr uint32_t npos = 0xFFFFFFFF;
+
+		const c_scope_table_t*          table = nullptr;
+		uint32_t                        count = 0;    // Entries within the readable size.
+		std::vector<node_t>             nodes = {};
+		bool                            nested = true;
+
+		// Constructed from the table and the number of bytes readable at it, e.g. the remainder of the section
+		// holding the unwind info, so that hostile entry counts never reach past it.
+		//
+		c_scope_index_t() = default;
+		c_scope_index_t( const c_scope_table_t* table, size_t size ) : table( table )
+		{
+			if ( size < offsetof( c_scope_table_t, entries ) )
+				return;
+			size_t limit = ( size - offsetof( c_scope_table_t, entries ) ) / sizeof( c_scope_table_entry_t );
+			count = uint32_t( std::min<size_t>( table->num_entries, limit ) );
+			nodes.reserve( count );
+			for ( uint32_t n = 0; n != count; n++ )
+			{
+				auto& entry = table->entries[ n ];
+				if ( entry.rva_begin < entry.rva_end )
+					nodes.push_back( { entry.rva_begin, entry.rva_end, npos, n } );
+			}
+
+			// Outer scopes first, for identical ranges the scope listed first in the table is the inner one.
+			//
+			std::sort( nodes.begin(), nodes.end(), [ ] ( const node_t& a, const node_t& b )
+			{
+				if ( a.rva_begin != b.rva_begin ) return a.rva_begin < b.rva_begin;
+				if ( a.rva_end != b.rva_end )     return a.rva_end > b.rva_end;
+				return a.entry > b.entry;
+			} );
+
+			// Link each scope to the one enclosing it.
+			//
+			std::vector<uint32_t> stack;
+			for ( uint32_t n = 0; n != nodes.size(); n++ )
+			{
+				while ( !stack.empty() && nodes[ stack.back() ].rva_end <= nodes[ n ].rva_begin )
+					stack.pop_back();
+				if ( !stack.empty() )
+				{
+					nested &= nodes[ stack.back() ].rva_end >= nodes[ n ].rva_end;
+					nodes[ n ].parent = stack.back();
+				}
+				stack.push_back( n );
+			}
+		}
+
+		// Invokes the callback for each scope covering the RVA, innermost first, until it returns true.
+		// - Returns the entry the search stopped at or null.
+		//
+		template<typename F>
+		const c_scope_table_entry_t* find_if( uint32_t rva, F&& fn ) const
+		{
+			if ( !nested )
+			{
+				for ( uint32_t n = 0; n != count; n++ )
+				{
+					auto& entry = table->entries[ n ];
+					if ( entry.rva_begin <= rva && rva < entry.rva_end && fn( entry ) )
+						return &entry;
+				}
+				return nullptr;
+			}
+
+			auto it = std::upper_bound( nodes.begin(), nodes.end(), rva, [ ] ( uint32_t rva, const node_t& node ) { return rva < node.rva_begin; } );
+			if ( it == nodes.begin() )
+				return nullptr;
+			for ( uint32_t n = uint32_t( it - nodes.begin() - 1 ); n != npos; n = nodes[ n ].parent )
+			{
+				auto& entry = table->entries[ nodes[ n ].entry ];
+				if ( rva < nodes[ n ].rva_end && fn( entry ) )
+					return &entry;
+			}
+			return nullptr;
+		}
+
+		// Collects all scopes covering the RVA, innermost first.
+		//
+		std::vector<const c_scope_table_entry_t*> covering( uint32_t rva ) const
+		{
+			std::vector<const c_scope_table_entry_t*> result;
+			find_if( rva, [ & ] ( const c_scope_table_entry_t& entry ) { result.push_back( &entry ); return false; } );
+			return result;
+		}
+	};
+
+	// Exception directory that is safe to look up on hostile inputs.
+	// - If the table is not sorted or has overlapping entries, lookups are redirected to a sorted and
+	//   deduplicated copy where the entry with the lowest start address wins and malformed entries are dropped.
+	//
+	struct checked_exception_directory_t
+	{
+		using iterator = exception_directory::iterator;
+
+		// Directory used for lookups, either the original view or a view of the sorted copy.
+		//
+		exception_directory                  directory = {};
+		std::vector<runtime_function_t>      sorted_copy = {};
+		exception_directory::validation_t    validation = {};
+
+		// Constructed from the original directory.
+		//
+		checked_exception_directory_t() = default;
+		checked_exception_directory_t( const exception_directory& dir ) : directory( dir ), sorted_copy(), validation( dir.validate() )
+		{
+			if ( validation.valid() )
+				return;
+
+			// Copy the well formed entries and sort them.
+			//
+			sorted_copy.reserve( dir.size() );
+			for ( auto& entry : dir )
+				if ( entry.rva_begin < entry.rva_end )
+					sorted_copy.emplace_back( entry );
+			std::stable_sort( sorted_copy.begin(), sorted_copy.end(), [ ] ( const auto& a, const auto& b )
+			{
+				return a.rva_begin != b.rva_begin ? a.rva_begin < b.rva_begin : a.rva_end > b.rva_end;
+			} );
+
+			// Drop the entries overlapping the previous one.
+			//
+			size_t count = 0;
+			for ( auto& entry : sorted_copy )
+				if ( !count || sorted_copy[ count - 1 ].rva_end <= entry.rva_begin )
+					sorted_copy[ count++ ] = entry;
+			sorted_copy.resize( count );
+			directory = { sorted_copy.data(), sorted_copy.size() * sizeof( runtime_function_t ) };
+		}
+
+		// Copying would invalidate the view, moving keeps the buffer.
+		//
+		checked_exception_directory_t( checked_exception_directory_t&& ) noexcept = default;
+		checked_exception_directory_t( const checked_exception_directory_t& ) = delete;
+		checked_exception_directory_t& operator=( checked_exception_directory_t&& ) noexcept = default;
+		checked_exception_directory_t& operator=( const checked_exception_directory_t& ) = delete;
+
+		// Basic properties.
+		//
+		bool is_copy() const { return !validation.valid(); }
+		iterator begin() const { return directory.begin(); }
+		iterator end() const { return directory.end(); }
+		size_t size() const { return directory.size(); }
+		bool empty() const { return directory.empty(); }
+
+		// Forward the lookups.
+		//
+		iterator find_overlapping( uint32_t rva ) const { return directory.find_overlapping( rva ); }
+		iterator find( uint32_t rva ) const { return directory.find( rva ); }
+		bool contains( uint32_t rva ) const { return directory.contains( rva ); }
+	};
+
+	// Accelerated lookup index over an exception directory.
+	// - Bounds are copied into an Eytzinger ordered SoA layout, lookups return the same entries as the directory.
+	//
+	struct exception_directory_index_t
+	{
+		using iterator = exception_directory::iterator;
+
+		// Viewed directory and the Eytzinger ordered copies, 1-based.
+		//
+		exception_directory         directory = {};
+		std::vector<uint32_t>       rva_end = {};
+		std::vector<uint32_t>       rva_begin = {};
+		std::vector<uint32_t>       position = {};
+
+		// Constructed from the directory, which should be sorted.
+		//
+		exception_directory_index_t() = default;
+		exception_directory_index_t( const exception_directory& dir ) : directory( dir )
+		{
+			rva_end.resize( dir.size() + 1 );
+			rva_begin.resize( dir.size() + 1 );
+			position.resize( dir.size() + 1 );
+
+			// In-order traversal of the implicit tree assigns the sorted entries.
+			//
+			uint32_t next = 0;
+			auto assign = [ & ] ( auto&& self, size_t k ) -> void
+			{
+				if ( k > dir.size() ) return;
+				self( self, 2 * k );
+				rva_end[ k ] = dir.table[ next ].rva_end;
+				rva_begin[ k ] = dir.table[ next ].rva_begin;
+				position[ k ] = next++;
+				self( self, 2 * k + 1 );
+			};
+			assign( assign, 1 );
+		}
+
+		// Basic properties.
+		//
+		iterator begin() const { return directory.begin(); }
+		iterator end() const { return directory.end(); }
+		size_t size() const { return directory.size(); }
+		bool empty() const { return directory.empty(); }
+
+		// Returns the slot of the first entry ending after the RVA or 0 if there is none.
+		//
+		size_t upper_bound_slot( uint32_t rva ) const
+		{
+			const uint32_t* ends = rva_end.data();
+			size_t k = 1;
+			while ( k < rva_end.size() )
+			{
+#if defined(__GNUC__) || defined(__clang__)
+				__builtin_prefetch( ( const void* ) ( uintptr_t( ends ) + k * 16 * sizeof( uint32_t ) ) );
+#endif
+				k = 2 * k + ( ends[ k ] <= rva );
+			}
+			return k >> ( std::countr_one( k ) + 1 );
+		}
+
+		// Lookups matching the exception directory.
+		//
+		iterator find_overlapping( uint32_t rva ) const
+		{
+			size_t k = upper_bound_slot( rva );
+			if ( !k || rva_begin[ k ] > rva )
+				return end();
+			return begin() + position[ k ];
+		}
+		iterator find( uint32_t rva ) const
+		{
+			size_t k = upper_bound_slot( rva );
+			if ( !k || rva_begin[ k ] != rva )
+				return end();
+			return begin() + position[ k ];
+		}
+		bool contains( uint32_t rva ) const
+		{
+			return find( rva ) != end();
+		}
+	};
+
+	// Descriptor of a module as seen by the frame unwinder.
+	// - View is expected to be mapped, RVAs are translated by a simple addition.
+	//
+	struct amd64_unwind_module_t
+	{
+		uint64_t                    image_base = 0;       // Address the module is loaded at in the unwound context.
+		size_t                      image_size = 0;       // Size of the mapped view.
+		const uint8_t*              mapped = nullptr;     // Mapped view of the image in the current process.
+		exception_directory         functions = {};       // Function table of the image.
+
+		// Basic helpers.
+		//
+		bool contains( uint64_t va ) const { return image_base <= va && va < ( image_base + image_size ); }
+
+		template<typename T = uint8_t>
+		const T* rva_to_ptr( uint32_t rva, size_t length = sizeof( T ) ) const
+		{
+			if ( !mapped || rva > image_size || length > ( image_size - rva ) )
+				return nullptr;
+			return ( const T* ) ( mapped + rva );
+		}
+
+		// Bounds checked unwind information getters.
+		//
+		const unwind_info_t* get_unwind_info( uint32_t rva ) const
+		{
+			auto* info = rva_to_ptr<unwind_info_t>( rva, offsetof( unwind_info_t, unwind_code ) );
+			if ( !info || !rva_to_ptr( rva, offsetof( unwind_info_t, unwind_code ) + sizeof( unwind_code_t ) * info->num_uw_codes ) )
+				return nullptr;
+			return info;
+		}
+		const runtime_function_t* get_chained_entry( uint32_t rva, const unwind_info_t* info ) const
+		{
+			uint32_t offset = ( uint32_t ) ( ( const uint8_t* ) info->get_language_specific_data() - ( const uint8_t* ) info );
+			return rva_to_ptr<runtime_function_t>( rva + offset );
+		}
+	};
+
+	// Enumerates the epilogs described by the version 2 epilog codes at the start of the unwind codes.
+	// - First code holds the epilog size and whether the last epilog is at the very end of the function.
+	// - Following codes hold the distance of each epilog from the end of the function, zero for padding.
+	//
+	template<typename F>
+	static void amd64_enum_epilogs( const unwind_info_t* info, const runtime_function_t& fn, F&& callback )
+	{
+		if ( info->version < 2 || !info->num_uw_codes || info->unwind_code[ 0 ].unwind_op != unwind_opcode::epilog )
+			return;
+
+		uint32_t size = info->unwind_code[ 0 ].code_offset;
+		if ( info->unwind_code[ 0 ].op_info & 1 )
+			callback( fn.rva_end - size, size );
+		for ( size_t n = 1; n < info->num_uw_codes && info->unwind_code[ n ].unwind_op == unwind_opcode::epilog; n++ )
+		{
+			uint32_t distance = info->unwind_code[ n ].code_offset | ( uint32_t( info->unwind_code[ n ].op_info ) << 8 );
+			if ( distance )
+				callback( fn.rva_end - distance, size );
+		}
+	}
+
+	// Returns the position of the RVA within an epilog of the function if any.
+	//
+	struct amd64_epilog_position_t
+	{
+		uint32_t                    offset;       // Offset of the RVA from the start of the epilog.
+		uint32_t                    size;         // Size of the epilog.
+	};
+	static std::optional<amd64_epilog_position_t> amd64_find_epilog( const unwind_info_t* info, const runtime_function_t& fn, uint32_t rva )
+	{
+		std::optional<amd64_epilog_position_t> result;
+		amd64_enum_epilogs( info, fn, [ & ] ( uint32_t begin, uint32_t size )
+		{
+			if ( !result && begin <= rva && ( rva - begin ) < size )
+				result = amd64_epilog_position_t{ rva - begin, size };
+		} );
+		return result;
+	}
+
+	// Unwinds the rest of an epilog described by version 2 epilog codes, without decoding any instructions.
+	// - Such epilogs are a single stack restore undoing every code but the pushes, followed by the pops mirroring the
+	//   push codes in code order and a one byte return, so the pops still pending follow from the distance to the
+	//   end of the epilog.
+	// - Chain is the primary record followed by the chained ones, whose pushes are popped by the same epilog.
+	// - Returns std::nullopt if the IP is at or before the stack restore, in which case none of the frame was undone
+	//   yet and the unwind codes apply in full, and false if the distance is not on an instruction boundary.
+	// - Return address is not popped.
+	//
+	template<typename S = amd64_unwind_state_t>
+	static std::optional<bool> amd64_unwind_epilog_codes( S& state, std::span<const unwind_info_t* const> chain, uint32_t remaining )
+	{
+		// Enumerates the pushes in the order they are popped, false if the codes are malformed.
+		//
+		bool has_machframe = false;
+		auto for_each_push = [ & ] ( auto&& fn )
+		{
+			for ( auto* info : chain )
+			{
+				for ( size_t n = 0; n < info->num_uw_codes; )
+				{
+					const unwind_code_t& code = info->unwind_code[ n ];
+					size_t size = 0;
+					bool valid = visit_amd64_unwind( code, [ & ] ( auto* op ) { size = op->get_size(); } );
+					if ( !valid || ( n + size ) > info->num_uw_codes )
+						return false;
+					has_machframe |= code.unwind_op == unwind_opcode::push_machframe;
+					if ( code.unwind_op == unwind_opcode::push_nonvol )
+						fn( unwind_register_id( code.op_info ), code.op_info >= 8 ? 2u : 1u );
+					n += size;
+				}
+			}
+			return true;
+		};
+
+		if ( chain.empty() )
+			return false;
+		uint32_t total = 0;
+		if ( !for_each_push( [ & ] ( unwind_register_id, uint32_t size ) { total += size; } ) )
+			return false;
+
+		// Nothing to do if the stack was not restored yet, machine frames end in an interrupt return which does not fit
+		// the layout above either.
+		//
+		if ( has_machframe || !remaining || ( remaining - 1 ) > total )
+			return std::nullopt;
+
+		// Skip the pops that already executed and pop the rest.
+		//
+		uint32_t skip = total - ( remaining - 1 );
+		bool success = true;
+		for_each_push( [ & ] ( unwind_register_id reg, uint32_t size )
+		{
+			if ( !success )
+				return;
+			if ( skip )
+			{
+				success = skip >= size;
+				skip -= std::min( skip, size );
+				return;
+			}
+			uint64_t value;
+			if ( ( success = state.read( value, state.sp() ) ) )
+			{
+				state.gp( reg ) = value;
+				state.sp() += 8;
+			}
+		} );
+		return success;
+	}
+
+	// Emulates the rest of the epilog starting at the RVA by decoding its instructions, used for version 1 records
+	// which do not describe their epilogs.
+	// - Recognizes the stack restore (add rsp, imm / lea rsp, [reg+disp] / mov rsp, reg), the pops of the non-volatile
+	//   registers and the terminating return or tail jump. Since the instructions undo the whole frame, chained
+	//   records need no separate handling and frame pointer epilogs are handled exactly.
+	// - Returns std::nullopt if the bytes do not form such a sequence, e.g. at a register restore preceding the stack
+	//   restore, in which case none of the frame was undone yet and the unwind codes apply in full.
+	// - Return address is not popped.
+	//
+	template<typename S = amd64_unwind_state_t>
+	static std::optional<bool> amd64_unwind_epilog( S& state, const amd64_unwind_module_t* module, uint32_t rva )
+	{
+		auto* code = module->rva_to_ptr<uint8_t>( rva, 1 );
+		if ( !code )
+			return std::nullopt;
+		size_t limit = module->image_size - rva;
+		size_t i = 0;
+		auto byte = [ & ] ( size_t k ) -> int { return ( i + k ) < limit ? code[ i + k ] : -1; };
+		auto imm32 = [ & ] ( size_t k ) -> std::optional<int32_t>
+		{
+			if ( ( i + k + 4 ) > limit )
+				return std::nullopt;
+			int32_t value;
+			memcpy( &value, code + i + k, 4 );
+			return value;
+		};
+
+		// Stack restore, if not executed yet.
+		//
+		std::optional<unwind_register_id> sp_base;
+		int64_t sp_disp = 0;
+		if ( int rex = byte( 0 ); ( rex & 0xF8 ) == 0x48 )
+		{
+			int opcode = byte( 1 ), modrm = byte( 2 );
+			if ( rex == 0x48 && opcode == 0x83 && modrm == 0xC4 && byte( 3 ) >= 0 )
+			{
+				sp_base = unwind_register_id::amd64_rsp;
+				sp_disp = int8_t( byte( 3 ) );
+				i += 4;
+			}
+			else if ( rex == 0x48 && opcode == 0x81 && modrm == 0xC4 )
+			{
+				auto imm = imm32( 3 );
+				if ( !imm ) return std::nullopt;
+				sp_base = unwind_register_id::amd64_rsp;
+				sp_disp = *imm;
+				i += 7;
+			}
+			else if ( opcode == 0x8D && modrm >= 0 && ( ( modrm >> 3 ) & 7 ) == 4 && !( rex & 6 ) )
+			{
+				// lea rsp, [reg+disp], register based without index.
+				//
+				int mod = modrm >> 6, rm = modrm & 7;
+				size_t at = 3;
+				if ( rm == 4 && byte( at++ ) != 0x24 )
+					return std::nullopt;
+				if ( mod == 1 && byte( at ) >= 0 )
+					sp_disp = int8_t( byte( at++ ) );
+				else if ( mod == 2 && imm32( at ) )
+					sp_disp = *imm32( at ), at += 4;
+				else if ( mod != 0 || rm == 5 )
+					return std::nullopt;
+				sp_base = unwind_register_id( rm | ( ( rex & 1 ) << 3 ) );
+				i += at;
+			}
+			else if ( opcode == 0x8B && modrm >= 0 && ( modrm & 0xF8 ) == 0xE0 && !( rex & 4 ) )
+			{
+				sp_base = unwind_register_id( ( modrm & 7 ) | ( ( rex & 1 ) << 3 ) );
+				i += 3;
+			}
+			else if ( opcode == 0x89 && modrm >= 0 && ( modrm & 0xC7 ) == 0xC4 && !( rex & 1 ) )
+			{
+				sp_base = unwind_register_id( ( ( modrm >> 3 ) & 7 ) | ( ( rex & 4 ) << 1 ) );
+				i += 3;
+			}
+		}
+
+		// Pops of the non-volatile registers.
+		//
+		unwind_register_id pops[ 16 ];
+		size_t num_pops = 0;
+		while ( num_pops != std::size( pops ) )
+		{
+			int b = byte( 0 ), reg;
+			if ( 0x58 <= b && b <= 0x5F )
+				reg = b - 0x58, i += 1;
+			else if ( b == 0x41 && 0x58 <= byte( 1 ) && byte( 1 ) <= 0x5F )
+				reg = 8 + byte( 1 ) - 0x58, i += 2;
+			else
+				break;
+			if ( reg == int( unwind_register_id::amd64_rsp ) )
+				return std::nullopt;
+			pops[ num_pops++ ] = unwind_register_id( reg );
+		}
+
+		// Return or tail jump.
+		//
+		int b = byte( 0 );
+		bool terminated =
+			b == 0xC3 || b == 0xC2 || ( b == 0xF3 && byte( 1 ) == 0xC3 ) ||   // ret, ret imm16, rep ret
+			b == 0xE9 || b == 0xEB ||                                            // jmp rel
+			( b == 0xFF && byte( 1 ) == 0x25 ) || ( b == 0x48 && byte( 1 ) == 0xFF && byte( 2 ) == 0x25 ); // jmp [rip+disp]
+		if ( !terminated )
+			return std::nullopt;
+
+		// Apply the effects in order.
+		//
+		if ( sp_base )
+			state.sp() = state.gp( *sp_base ) + sp_disp;
+		for ( size_t n = 0; n != num_pops; n++ )
+		{
+			uint64_t value;
+			if ( !state.read( value, state.sp() ) )
+				return false;
+			state.gp( pops[ n ] ) = value;
+			state.sp() += 8;
+		}
+		return true;
+	}
+
+	// Unwinds the rest of the epilog the IP is in, std::nullopt if it is not within one.
+	// - Version 2 records locate the IP through their epilog codes, the chain is only resolved in that case.
+	// - Version 1 records do not describe their epilogs, so past the prologue the bytes at the IP are decoded instead.
+	//
+	template<typename S, typename C>
+	static std::optional<bool> amd64_try_unwind_epilog( S& state, const amd64_unwind_module_t* module, const runtime_function_t& fn, const unwind_info_t* info, uint64_t prologue_offset, C&& get_chain )
+	{
+		uint32_t rva = uint32_t( fn.rva_begin + prologue_offset );
+		if ( info->version >= 2 )
+		{
+			if ( auto epilog = amd64_find_epilog( info, fn, rva ) )
+				return amd64_unwind_epilog_codes( state, get_chain(), epilog->size - epilog->offset );
+			return std::nullopt;
+		}
+		if ( prologue_offset < info->size_prologue )
+			return std::nullopt;
+		return amd64_unwind_epilog( state, module, rva );
+	}
+
+	// Applies the unwind codes of a single unwind info record.
+	// - Codes describing the part of the prologue after the given offset are skipped.
+	//
+	template<typename S = amd64_unwind_state_t>
+	static bool amd64_unwind_codes( S& state, const unwind_info_t* info, uint64_t prologue_offset, bool& has_machframe )
+	{
+		state.frame_offset = info->frame_offset;
+		state.frame_register = info->frame_register;
+
+		for ( size_t n = 0; n < info->num_uw_codes; )
+		{
+			const unwind_code_t& code = info->unwind_code[ n ];
+			bool success = true;
+			bool valid = visit_amd64_unwind( code, [ & ] ( auto* op )
+			{
+				size_t size = op->get_size();
+				if ( ( n + size ) > info->num_uw_codes )
+				{
+					success = false;
+					return;
+				}
+
+				bool apply = code.code_offset <= prologue_offset;
+				if ( code.unwind_op == unwind_opcode::epilog && info->version >= 2 )
+					apply = false;
+				if ( apply )
+				{
+					success = op->unwind( state );
+					has_machframe |= code.unwind_op == unwind_opcode::push_machframe;
+				}
+				n += size;
+			} );
+			if ( !valid || !success )
+				return false;
+		}
+		return true;
+	}
+
+	// Unwinds a single frame of the function described by the given entry.
+	// - If no entry is given the function is assumed to be a leaf function.
+	// - IP is expected to be within the module and the entry.
+	//
+	static constexpr size_t amd64_max_unwind_chain_depth = 32;
+	template<typename S = amd64_unwind_state_t>
+	static bool amd64_unwind_frame( S& state, const amd64_unwind_module_t* module, const runtime_function_t* fn )
+	{
+		// Leaf functions simply return.
+		//
+		if ( !module || !fn )
+			return amd64_unwind_call( state );
+
+		// Determine the offset within the function, used to skip the part of the prologue that did not execute yet.
+		//
+		uint64_t prologue_offset = state.ip() - module->image_base - fn->rva_begin;
+		bool has_machframe = false;
+		for ( size_t depth = 0; depth <= amd64_max_unwind_chain_depth; depth++ )
+		{
+			// Resolve the unwind information and apply the codes, chained entries are applied as a whole.
+			//
+			auto* info = module->get_unwind_info( fn->rva_unwind_info );
+			if ( !info )
+				return false;
+
+			// Within an epilog only its remaining part is unwound.
+			//
+			if ( !depth )
+			{
+				const unwind_info_t* chain[ amd64_max_unwind_chain_depth + 1 ];
+				auto get_chain = [ & ] () -> std::span<const unwind_info_t* const>
+				{
+					size_t count = 0;
+					for ( auto* it = fn; it; it = module->get_chained_entry( it->rva_unwind_info, chain[ count - 1 ] ) )
+					{
+						if ( count == std::size( chain ) || !( chain[ count ] = module->get_unwind_info( it->rva_unwind_info ) ) )
+							return {};
+						if ( !chain[ count++ ]->chained )
+							return { chain, count };
+					}
+					return {};
+				};
+				if ( auto result = amd64_try_unwind_epilog( state, module, *fn, info, prologue_offset, get_chain ) )
+					return *result && amd64_unwind_call( state );
+			}
+			if ( !amd64_unwind_codes( state, info, depth ? UINT64_MAX : prologue_offset, has_machframe ) )
+				return false;
+
+			// If chained, continue with the parent entry.
+			//
+			if ( !info->chained )
+			{
+				// Machine frames restore the IP themselves, otherwise pop the return address.
+				//
+				return has_machframe || amd64_unwind_call( state );
+			}
+			fn = module->get_chained_entry( fn->rva_unwind_info, info );
+			if ( !fn ) return false;
+		}
+		return false;
+	}
+
+	// Resolver flattening chained unwind information, memoized per unwind info RVA.
+	// - Chains deeper than the limit or containing cycles are resolved as invalid.
+	//
+	struct unwind_chain_resolver_t
+	{
+		// Single record in the chain, entry is null for the primary record.
+		//
+		struct link_t
+		{
+			const runtime_function_t*   entry;
+			const unwind_info_t*        info;
+		};
+		struct chain_t
+		{
+			std::vector<link_t>         links = {};
+			bool                        valid = false;
+
+			auto begin() const { return links.begin(); }
+			auto end() const { return links.end(); }
+		};
+
+		const amd64_unwind_module_t*             module = nullptr;
+		size_t                                   max_depth = amd64_max_unwind_chain_depth;
+		std::unordered_map<uint32_t, chain_t>    cache = {};
+
+		// Resolves the chain starting at the given unwind info RVA.
+		// - References are stable until the resolver is destroyed.
+		//
+		const chain_t& resolve( uint32_t rva_unwind_info )
+		{
+			if ( auto it = cache.find( rva_unwind_info ); it != cache.end() )
+				return it->second;
+
+			// Walk the chain until a memoized record, the end of the chain or an error.
+			//
+			std::vector<std::pair<uint32_t, link_t>> path;
+			const runtime_function_t* via = nullptr;
+			const chain_t* tail = nullptr;
+			bool poisoned = false, truncated = false;
+			for ( uint32_t rva = rva_unwind_info;; )
+			{
+				if ( ( truncated = path.size() > max_depth ) )
+					break;
+				if ( auto it = cache.find( rva ); it != cache.end() )
+				{
+					tail = &it->second;
+					poisoned = !tail->valid;
+					break;
+				}
+
+				auto* info = module->get_unwind_info( rva );
+				bool cycle = std::find_if( path.begin(), path.end(), [ & ] ( auto& e ) { return e.first == rva; } ) != path.end();
+				if ( !info || cycle )
+				{
+					poisoned = true;
+					break;
+				}
+
+				path.push_back( { rva, link_t{ via, info } } );
+				if ( !info->chained )
+					break;
+				if ( !( via = module->get_chained_entry( rva, info ) ) )
+				{
+					poisoned = true;
+					break;
+				}
+				rva = via->rva_unwind_info;
+			}
+
+			// If the chain is broken, every record on the path leads to the same error.
+			//
+			if ( poisoned )
+			{
+				for ( auto& [rva, link] : path )
+					cache[ rva ] = {};
+				return cache[ rva_unwind_info ];
+			}
+			if ( truncated )
+				return cache[ rva_unwind_info ] = {};
+
+			// Memoize every suffix of the path that is within the depth limit.
+			//
+			size_t tail_length = tail ? tail->links.size() : 0;
+			for ( size_t i = 0; i != path.size(); i++ )
+			{
+				if ( ( path.size() - i + tail_length ) > ( max_depth + 1 ) )
+					continue;
+
+				chain_t& chain = cache[ path[ i ].first ];
+				chain.valid = true;
+				chain.links.reserve( path.size() - i + tail_length );
+				for ( size_t j = i; j != path.size(); j++ )
+					chain.links.push_back( { j == i ? nullptr : path[ j ].second.entry, path[ j ].second.info } );
+				for ( size_t j = 0; j != tail_length; j++ )
+					chain.links.push_back( { j == 0 ? via : tail->links[ j ].entry, tail->links[ j ].info } );
+			}
+			return cache[ rva_unwind_info ];
+		}
+	};
+
+	// Unwinds a single frame of the function using its resolved chain.
+	//
+	template<typename S = amd64_unwind_state_t>
+	static bool amd64_unwind_frame( S& state, const amd64_unwind_module_t* module, const runtime_function_t* fn, const unwind_chain_resolver_t::chain_t& chain )
+	{
+		if ( !chain.valid )
+			return false;
+
+		uint64_t prologue_offset = state.ip() - module->image_base - fn->rva_begin;
+		if ( chain.begin() != chain.end() )
+		{
+			const unwind_info_t* infos[ amd64_max_unwind_chain_depth + 1 ];
+			auto get_chain = [ & ] () -> std::span<const unwind_info_t* const>
+			{
+				size_t count = chain.links.size();
+				if ( count > std::size( infos ) )
+					return {};
+				for ( size_t n = 0; n != count; n++ )
+					infos[ n ] = chain.links[ n ].info;
+				return { infos, count };
+			};
+			if ( auto result = amd64_try_unwind_epilog( state, module, *fn, chain.begin()->info, prologue_offset, get_chain ) )
+				return *result && amd64_unwind_call( state );
+		}
+
+		bool has_machframe = false;
+		for ( auto& link : chain )
+		{
+			if ( !amd64_unwind_codes( state, link.info, link.entry ? UINT64_MAX : prologue_offset, has_machframe ) )
+				return false;
+		}
+		return has_machframe || amd64_unwind_call( state );
+	}
+
+	// Unwinds a single frame using the memoized chain resolver.
+	//
+	template<typename S = amd64_unwind_state_t>
+	static bool amd64_unwind_frame( S& state, unwind_chain_resolver_t& resolver, const runtime_function_t* fn )
+	{
+		if ( !resolver.module || !fn )
+			return amd64_unwind_call( state );
+		return amd64_unwind_frame( state, resolver.module, fn, resolver.resolve( fn->rva_unwind_info ) );
+	}
+};
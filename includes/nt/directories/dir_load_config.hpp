@@ -26,6 +26,12 @@
 // POSSIBILITY OF SUCH DAMAGE.        
 //
 #pragma once
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <vector>
 #include "../../img_common.hpp"
 #include "../data_directories.hpp"
 #include "dir_relocs.hpp"
@@ -207,6 +213,77 @@ namespace win
         uint8_t                     sha1[ 20 ];
     };
 
+    // Volatile metadata
+    //
+    struct volatile_metadata_t
+    {
+        uint32_t                    size;
+        uint32_t                    version;
+        uint32_t                    rva_access_table;                   // RVAs of instructions accessing memory with volatile semantics.
+        uint32_t                    size_access_table;
+        uint32_t                    rva_info_range_table;               // Ranges whose accesses all have volatile semantics.
+        uint32_t                    size_info_range_table;
+    };
+
+    struct volatile_range_t
+    {
+        uint32_t                    rva;
+        uint32_t                    size;
+    };
+
+    // Hybrid (CHPE) metadata
+    //
+    struct chpe_range_entry_t
+    {
+        uint32_t                    start_offset;                       // Low bits describe the code type.
+        uint32_t                    length;
+
+        inline bool                 x86_is_native() const { return start_offset & 1; }
+        inline uint32_t             x86_rva() const { return start_offset & ~1u; }
+        inline uint32_t             arm64ec_type() const { return start_offset & 3; }
+        inline uint32_t             arm64ec_rva() const { return start_offset & ~3u; }
+    };
+
+    struct chpe_metadata_x86_t
+    {
+        uint32_t                    version;
+        uint32_t                    chpe_code_address_range_offset;
+        uint32_t                    chpe_code_address_range_count;
+        uint32_t                    wowa64_exception_handler_function_ptr;
+        uint32_t                    wowa64_dispatch_call_function_ptr;
+        uint32_t                    wowa64_dispatch_indirect_call_function_ptr;
+        uint32_t                    wowa64_dispatch_indirect_call_cfg_function_ptr;
+        uint32_t                    wowa64_dispatch_ret_function_ptr;
+        uint32_t                    wowa64_dispatch_ret_leaf_function_ptr;
+        uint32_t                    wowa64_dispatch_jump_function_ptr;
+        uint32_t                    compiler_iat_ptr;                   // Version 2+.
+        uint32_t                    wowa64_rdtsc_function_ptr;          // Version 3+.
+    };
+
+    struct arm64ec_metadata_t
+    {
+        uint32_t                    version;
+        uint32_t                    code_map;
+        uint32_t                    code_map_count;
+        uint32_t                    code_ranges_to_entry_points;
+        uint32_t                    redirection_metadata;
+        uint32_t                    os_arm64x_dispatch_call_no_redirect;
+        uint32_t                    os_arm64x_dispatch_ret;
+        uint32_t                    os_arm64x_dispatch_call;
+        uint32_t                    os_arm64x_dispatch_icall;
+        uint32_t                    os_arm64x_dispatch_icall_cfg;
+        uint32_t                    alternate_entry_point;
+        uint32_t                    auxiliary_iat;
+        uint32_t                    code_ranges_to_entry_points_count;
+        uint32_t                    redirection_metadata_count;
+        uint32_t                    get_x64_information_function_ptr;
+        uint32_t                    set_x64_information_function_ptr;
+        uint32_t                    extra_rfe_table;
+        uint32_t                    extra_rfe_table_size;
+        uint32_t                    os_arm64x_dispatch_fptr;
+        uint32_t                    auxiliary_iat_copy;
+    };
+
     // Code integrity information
     //
     struct load_config_ci_t
@@ -217,6 +294,41 @@ namespace win
         uint32_t                    _pad0;                              // Additional bitmask to be defined later
     };
 
+    // Guard flags
+    //
+    enum guard_flags_t : uint32_t
+    {
+        guard_cf_instrumented =                     0x00000100,
+        guard_cfw_instrumented =                    0x00000200,
+        guard_cf_function_table_present =           0x00000400,
+        guard_security_cookie_unused =              0x00000800,
+        guard_protect_delayload_iat =               0x00001000,
+        guard_delayload_iat_in_its_own_section =    0x00002000,
+        guard_cf_export_suppression_info_present =  0x00004000,
+        guard_cf_enable_export_suppression =        0x00008000,
+        guard_cf_longjump_table_present =           0x00010000,
+        guard_rf_instrumented =                     0x00020000,
+        guard_rf_enable =                           0x00040000,
+        guard_rf_strict =                           0x00080000,
+        guard_retpoline_present =                   0x00100000,
+        guard_eh_continuation_table_present =       0x00400000,
+        guard_xfg_enabled =                         0x00800000,
+        guard_castguard_present =                   0x01000000,
+        guard_memcpy_present =                      0x02000000,
+        guard_cf_function_table_size_mask =         0xF0000000,     // Number of metadata bytes following each table entry.
+        guard_cf_function_table_size_shift =        28,
+    };
+
+    // Metadata flags of guard function table entries
+    //
+    enum guard_fid_flags_t : uint8_t
+    {
+        guard_fid_suppressed =                      0x01,           // Call target is explicitly suppressed.
+        guard_fid_export_suppressed =               0x02,           // Call target is export suppressed.
+        guard_fid_langexcpthandler =                0x04,
+        guard_fid_xfg =                             0x08,           // Preceded by an XFG type hash.
+    };
+
     template<bool x64 = default_architecture>
     struct load_config_directory_t
     {
@@ -270,9 +382,571 @@ namespace win
         va_t                        enclave_configuration_ptr;
         va_t                        volatile_metadata_ptr;
         table_t                     guard_eh_continuation_table;
+        va_t                        guard_xfg_check_function_ptr;
+        va_t                        guard_xfg_dispatch_function_ptr;
+        va_t                        guard_xfg_table_dispatch_function_ptr;
+        va_t                        cast_guard_os_determined_failure_mode;
+        va_t                        guard_memcpy_function_ptr;
     };
     using load_config_directory_x86_t = load_config_directory_t<false>;
     using load_config_directory_x64_t = load_config_directory_t<true>;
     template<bool x64> struct directory_type<directory_id::directory_entry_load_config, x64, void> { using type = load_config_directory_t<x64>; };
 };
-#pragma pack(pop)
\ No newline at end of file
+#pragma pack(pop)
+
+namespace win
+{
+    template<bool x64> struct image_t;
+
+    // Guard tables sharing the GFIDS entry layout.
+    //
+    enum guard_table_id_t : uint8_t
+    {
+        guard_table_function =              1 << 0,     // Valid indirect call targets.
+        guard_table_address_taken_iat =     1 << 1,     // Address taken IAT entries.
+        guard_table_long_jump =             1 << 2,     // Valid longjmp targets.
+        guard_table_eh_continuation =       1 << 3,     // Valid exception handling continuation targets.
+        guard_table_all =                   0xF,
+    };
+
+    // Load config accessor aware of the size the image actually carries.
+    // - The available prefix is copied once into a zero filled snapshot, so that fields beyond it read as zero as they
+    //   do for the loader and the hot path can read the snapshot directly.
+    // - get/get_rva return std::nullopt for fields not covered by the size, get_rva reads RVAs converted once as well.
+    //
+    template<bool x64 = default_architecture>
+    struct load_config_view_t
+    {
+        using directory_t = load_config_directory_t<x64>;
+
+        directory_t                 snapshot = {};
+        directory_t                 rebased = {};          // VA fields of the snapshot as RVAs, zero if invalid.
+        const directory_t*          directory = nullptr;   // In the image.
+        size_t                      available = 0;         // Bytes of the snapshot taken from the image.
+        uint64_t                    image_base = 0;
+
+        // Offset of a field, resolved at compile-time. Member pointers cannot be converted to offsets in constant
+        // expressions, so they are matched against the table of the directory fields instead.
+        //
+        template<auto M>
+        static consteval size_t field_offset()
+        {
+            size_t offset = SIZE_MAX;
+            auto match = [ & ] ( auto field, size_t field_offset )
+            {
+                if constexpr ( std::is_same_v<decltype( field ), decltype( M )> )
+                    if ( field == M ) offset = field_offset;
+            };
+            match( &directory_t::size,                                   offsetof( directory_t, size ) );
+            match( &directory_t::timedate_stamp,                         offsetof( directory_t, timedate_stamp ) );
+            match( &directory_t::version,                                offsetof( directory_t, version ) );
+            match( &directory_t::global_flags_clear,                     offsetof( directory_t, global_flags_clear ) );
+            match( &directory_t::global_flags_set,                       offsetof( directory_t, global_flags_set ) );
+            match( &directory_t::critical_section_default_timeout,       offsetof( directory_t, critical_section_default_timeout ) );
+            match( &directory_t::decommit_free_block_threshold,          offsetof( directory_t, decommit_free_block_threshold ) );
+            match( &directory_t::decommit_total_free_threshold,          offsetof( directory_t, decommit_total_free_threshold ) );
+            match( &directory_t::lock_prefix_table,                      offsetof( directory_t, lock_prefix_table ) );
+            match( &directory_t::maximum_allocation_size,                offsetof( directory_t, maximum_allocation_size ) );
+            match( &directory_t::virtual_memory_threshold,               offsetof( directory_t, virtual_memory_threshold ) );
+            match( &directory_t::process_affinity_mask,                  offsetof( directory_t, process_affinity_mask ) );
+            match( &directory_t::process_heap_flags,                     offsetof( directory_t, process_heap_flags ) );
+            match( &directory_t::csd_version,                            offsetof( directory_t, csd_version ) );
+            match( &directory_t::dependent_load_flags,                   offsetof( directory_t, dependent_load_flags ) );
+            match( &directory_t::edit_list,                              offsetof( directory_t, edit_list ) );
+            match( &directory_t::security_cookie,                        offsetof( directory_t, security_cookie ) );
+            match( &directory_t::se_handler_table,                       offsetof( directory_t, se_handler_table ) );
+            match( &directory_t::guard_cf_check_function_ptr,            offsetof( directory_t, guard_cf_check_function_ptr ) );
+            match( &directory_t::guard_cf_dispatch_function_ptr,         offsetof( directory_t, guard_cf_dispatch_function_ptr ) );
+            match( &directory_t::guard_cf_function_table,                offsetof( directory_t, guard_cf_function_table ) );
+            match( &directory_t::guard_flags,                            offsetof( directory_t, guard_flags ) );
+            match( &directory_t::code_integrity,                         offsetof( directory_t, code_integrity ) );
+            match( &directory_t::guard_address_taken_iat_entry_table,    offsetof( directory_t, guard_address_taken_iat_entry_table ) );
+            match( &directory_t::guard_long_jump_target_table,           offsetof( directory_t, guard_long_jump_target_table ) );
+            match( &directory_t::dynamic_value_reloc_table,              offsetof( directory_t, dynamic_value_reloc_table ) );
+            match( &directory_t::chpe_metadata_ptr,                      offsetof( directory_t, chpe_metadata_ptr ) );
+            match( &directory_t::guard_rf_failure_routine,               offsetof( directory_t, guard_rf_failure_routine ) );
+            match( &directory_t::guard_rf_failure_routine_function_ptr,  offsetof( directory_t, guard_rf_failure_routine_function_ptr ) );
+            match( &directory_t::dynamic_value_reloc_table_offset,       offsetof( directory_t, dynamic_value_reloc_table_offset ) );
+            match( &directory_t::dynamic_value_reloc_table_section,      offsetof( directory_t, dynamic_value_reloc_table_section ) );
+            match( &directory_t::guard_rf_verify_stack_ptr_function_ptr, offsetof( directory_t, guard_rf_verify_stack_ptr_function_ptr ) );
+            match( &directory_t::hotpatch_table_offset,                  offsetof( directory_t, hotpatch_table_offset ) );
+            match( &directory_t::reserved,                               offsetof( directory_t, reserved ) );
+            match( &directory_t::enclave_configuration_ptr,              offsetof( directory_t, enclave_configuration_ptr ) );
+            match( &directory_t::volatile_metadata_ptr,                  offsetof( directory_t, volatile_metadata_ptr ) );
+            match( &directory_t::guard_eh_continuation_table,            offsetof( directory_t, guard_eh_continuation_table ) );
+            match( &directory_t::guard_xfg_check_function_ptr,           offsetof( directory_t, guard_xfg_check_function_ptr ) );
+            match( &directory_t::guard_xfg_dispatch_function_ptr,        offsetof( directory_t, guard_xfg_dispatch_function_ptr ) );
+            match( &directory_t::guard_xfg_table_dispatch_function_ptr,  offsetof( directory_t, guard_xfg_table_dispatch_function_ptr ) );
+            match( &directory_t::cast_guard_os_determined_failure_mode,  offsetof( directory_t, cast_guard_os_determined_failure_mode ) );
+            match( &directory_t::guard_memcpy_function_ptr,              offsetof( directory_t, guard_memcpy_function_ptr ) );
+            return offset;
+        }
+        template<auto M>
+        static constexpr size_t field_end()
+        {
+            constexpr size_t offset = field_offset<M>();
+            static_assert( offset != SIZE_MAX, "Unknown load config field." );
+            return offset + sizeof( directory_t{}.*M );
+        }
+
+        template<auto M> inline bool has() const { return field_end<M>() <= available; }
+        template<auto M>
+        inline auto get() const -> std::optional<std::remove_cvref_t<decltype( snapshot.*M )>>
+        {
+            if ( !has<M>() ) return std::nullopt;
+            return snapshot.*M;
+        }
+
+        // RVA of a VA field, std::nullopt if not present, null, at the image base or outside the 32-bit image range.
+        //
+        template<auto M>
+        inline std::optional<uint32_t> get_rva() const
+        {
+            if ( !has<M>() ) return std::nullopt;
+            uint64_t rva;
+            if constexpr ( requires { ( rebased.*M ).virtual_address; } )
+                rva = ( rebased.*M ).virtual_address;
+            else
+                rva = rebased.*M;
+            if ( !rva ) return std::nullopt;
+            return uint32_t( rva );
+        }
+
+        inline bool present() const { return directory != nullptr; }
+        inline const directory_t* operator->() const { return &snapshot; }
+
+        template<bool x>
+        static load_config_view_t from_image( const image_t<x>* image )
+        {
+            static_assert( x == x64, "Architecture mismatch." );
+            load_config_view_t view = {};
+            view.image_base = image->get_nt_headers()->optional_header.image_base;
+            auto* dir = image->get_directory( directory_entry_load_config );
+            if ( !dir )
+                return view;
+            auto* config = image->template rva_to_ptr<directory_t>( dir->rva, sizeof( uint32_t ) );
+            if ( !config )
+                return view;
+
+            // Size is bounded by the structure, the directory and the raw data of the section holding it.
+            //
+            size_t size = std::min<size_t>( { config->size, dir->size, sizeof( directory_t ) } );
+            size_t limit;
+            if ( auto* scn = image->rva_to_section( dir->rva ) )
+                limit = scn->size_raw_data - ( dir->rva - scn->virtual_address );
+            else
+                limit = image->get_nt_headers()->optional_header.size_headers - dir->rva;
+            size = std::min( size, limit );
+            view.directory = config;
+            view.available = size;
+            memcpy( &view.snapshot, config, size );
+
+            // Convert the VA fields once so that get_rva is a plain read.
+            //
+            auto rebase = [ & ] ( const auto& va, auto& rva )
+            {
+                if ( va && va >= view.image_base && ( va - view.image_base ) <= UINT32_MAX )
+                    rva = uint32_t( va - view.image_base );
+            };
+            for ( auto field : { &directory_t::lock_prefix_table, &directory_t::edit_list, &directory_t::security_cookie,
+                                 &directory_t::guard_cf_check_function_ptr, &directory_t::guard_cf_dispatch_function_ptr,
+                                 &directory_t::dynamic_value_reloc_table, &directory_t::chpe_metadata_ptr,
+                                 &directory_t::guard_rf_failure_routine, &directory_t::guard_rf_failure_routine_function_ptr,
+                                 &directory_t::guard_rf_verify_stack_ptr_function_ptr, &directory_t::enclave_configuration_ptr,
+                                 &directory_t::volatile_metadata_ptr, &directory_t::guard_xfg_check_function_ptr,
+                                 &directory_t::guard_xfg_dispatch_function_ptr, &directory_t::guard_xfg_table_dispatch_function_ptr,
+                                 &directory_t::cast_guard_os_determined_failure_mode, &directory_t::guard_memcpy_function_ptr } )
+                rebase( view.snapshot.*field, view.rebased.*field );
+            for ( auto field : { &directory_t::se_handler_table, &directory_t::guard_cf_function_table,
+                                 &directory_t::guard_address_taken_iat_entry_table, &directory_t::guard_long_jump_target_table,
+                                 &directory_t::guard_eh_continuation_table } )
+                rebase( ( view.snapshot.*field ).virtual_address, ( view.rebased.*field ).virtual_address );
+            return view;
+        }
+    };
+
+    // Volatile metadata referenced by the load config.
+    //
+    struct volatile_metadata_view_t
+    {
+        const volatile_metadata_t*  header = nullptr;
+        std::span<const uint32_t>   accesses = {};
+        std::span<const volatile_range_t> ranges = {};
+
+        template<bool x64>
+        static volatile_metadata_view_t from_image( const image_t<x64>* image, const load_config_view_t<x64>& config )
+        {
+            volatile_metadata_view_t view = {};
+            auto rva = config.template get_rva<&load_config_directory_t<x64>::volatile_metadata_ptr>();
+            if ( !rva || !( view.header = image->template rva_to_ptr<volatile_metadata_t>( *rva, sizeof( volatile_metadata_t ) ) ) )
+                return view;
+            if ( view.header->size < sizeof( volatile_metadata_t ) )
+                return view;
+            if ( auto* table = image->template rva_to_ptr<uint32_t>( view.header->rva_access_table, view.header->size_access_table ) )
+                view.accesses = { table, view.header->size_access_table / sizeof( uint32_t ) };
+            if ( auto* table = image->template rva_to_ptr<volatile_range_t>( view.header->rva_info_range_table, view.header->size_info_range_table ) )
+                view.ranges = { table, view.header->size_info_range_table / sizeof( volatile_range_t ) };
+            return view;
+        }
+        template<bool x64>
+        static volatile_metadata_view_t from_image( const image_t<x64>* image ) { return from_image( image, load_config_view_t<x64>::from_image( image ) ); }
+    };
+
+    // Sorted lookups over the volatile metadata.
+    // - Ranges are merged so that lookups are a single search over disjoint intervals.
+    //
+    struct volatile_metadata_index_t
+    {
+        std::vector<uint32_t>       accesses = {};
+        std::vector<uint32_t>       range_begin = {};
+        std::vector<uint32_t>       range_end = {};
+
+        static volatile_metadata_index_t build( const volatile_metadata_view_t& view )
+        {
+            volatile_metadata_index_t index = {};
+            index.accesses.assign( view.accesses.begin(), view.accesses.end() );
+            if ( !std::is_sorted( index.accesses.begin(), index.accesses.end() ) )
+                std::sort( index.accesses.begin(), index.accesses.end() );
+
+            std::vector<volatile_range_t> ranges( view.ranges.begin(), view.ranges.end() );
+            std::sort( ranges.begin(), ranges.end(), [ ] ( const auto& a, const auto& b ) { return a.rva < b.rva; } );
+            for ( auto& range : ranges )
+            {
+                if ( !range.size )
+                    continue;
+                uint32_t end = uint32_t( std::min<uint64_t>( uint64_t( range.rva ) + range.size, UINT32_MAX ) );
+                if ( !index.range_end.empty() && range.rva <= index.range_end.back() )
+                {
+                    index.range_end.back() = std::max( index.range_end.back(), end );
+                    continue;
+                }
+                index.range_begin.push_back( range.rva );
+                index.range_end.push_back( end );
+            }
+            return index;
+        }
+        template<bool x64>
+        static volatile_metadata_index_t build( const image_t<x64>* image ) { return build( volatile_metadata_view_t::from_image( image ) ); }
+
+        inline bool is_volatile_access( uint32_t rva ) const { return std::binary_search( accesses.begin(), accesses.end(), rva ); }
+        inline bool in_volatile_range( uint32_t rva ) const
+        {
+            auto it = std::upper_bound( range_end.begin(), range_end.end(), rva );
+            return it != range_end.end() && range_begin[ it - range_end.begin() ] <= rva;
+        }
+        inline bool is_volatile( uint32_t rva ) const { return in_volatile_range( rva ) || is_volatile_access( rva ); }
+    };
+
+    // Code types described by the hybrid metadata.
+    //
+    enum class hybrid_code_type : uint8_t
+    {
+        arm64 =                     0,
+        arm64ec =                   1,
+        amd64 =                     2,
+        x86 =                       3,
+    };
+
+    // Sorted map of the code ranges of CHPE (x86) and ARM64EC/ARM64X (x64) images.
+    //
+    struct hybrid_code_map_t
+    {
+        std::vector<uint32_t>       rva_begin = {};
+        std::vector<uint32_t>       rva_end = {};
+        std::vector<hybrid_code_type> types = {};
+
+        // Range entries of the image in place, empty if it has no hybrid metadata.
+        //
+        template<bool x64>
+        static std::span<const chpe_range_entry_t> get_ranges( const image_t<x64>* image, const load_config_view_t<x64>& config )
+        {
+            auto rva = config.template get_rva<&load_config_directory_t<x64>::chpe_metadata_ptr>();
+            if ( !rva )
+                return {};
+            uint32_t table_rva, count;
+            if constexpr ( x64 )
+            {
+                auto* metadata = image->template rva_to_ptr<arm64ec_metadata_t>( *rva, offsetof( arm64ec_metadata_t, code_ranges_to_entry_points ) );
+                if ( !metadata ) return {};
+                table_rva = metadata->code_map;
+                count = metadata->code_map_count;
+            }
+            else
+            {
+                auto* metadata = image->template rva_to_ptr<chpe_metadata_x86_t>( *rva, offsetof( chpe_metadata_x86_t, wowa64_exception_handler_function_ptr ) );
+                if ( !metadata ) return {};
+                table_rva = metadata->chpe_code_address_range_offset;
+                count = metadata->chpe_code_address_range_count;
+            }
+            if ( count > ( UINT32_MAX / sizeof( chpe_range_entry_t ) ) )
+                return {};
+            auto* table = image->template rva_to_ptr<chpe_range_entry_t>( table_rva, count * sizeof( chpe_range_entry_t ) );
+            return table ? std::span{ table, count } : std::span<const chpe_range_entry_t>{};
+        }
+
+        template<bool x64>
+        static hybrid_code_map_t build( const image_t<x64>* image )
+        {
+            hybrid_code_map_t map = {};
+            auto ranges = get_ranges( image, load_config_view_t<x64>::from_image( image ) );
+
+            struct item_t { uint32_t begin, end; hybrid_code_type type; };
+            std::vector<item_t> items;
+            items.reserve( ranges.size() );
+            for ( auto& range : ranges )
+            {
+                item_t item;
+                if constexpr ( x64 )
+                {
+                    if ( range.arm64ec_type() > uint32_t( hybrid_code_type::amd64 ) ) continue;
+                    item = { range.arm64ec_rva(), 0, hybrid_code_type( range.arm64ec_type() ) };
+                }
+                else
+                {
+                    item = { range.x86_rva(), 0, range.x86_is_native() ? hybrid_code_type::arm64 : hybrid_code_type::x86 };
+                }
+                item.end = uint32_t( std::min<uint64_t>( uint64_t( item.begin ) + range.length, UINT32_MAX ) );
+                if ( item.begin != item.end )
+                    items.push_back( item );
+            }
+            std::sort( items.begin(), items.end(), [ ] ( const item_t& a, const item_t& b ) { return a.begin < b.begin; } );
+
+            // Overlapping ranges are clipped to the start of the next one.
+            //
+            for ( size_t i = 0; i != items.size(); i++ )
+            {
+                uint32_t end = ( i + 1 ) != items.size() ? std::min( items[ i ].end, items[ i + 1 ].begin ) : items[ i ].end;
+                if ( end <= items[ i ].begin )
+                    continue;
+                map.rva_begin.push_back( items[ i ].begin );
+                map.rva_end.push_back( end );
+                map.types.push_back( items[ i ].type );
+            }
+            return map;
+        }
+
+        // Type of the code at the RVA, std::nullopt if not described.
+        //
+        inline std::optional<hybrid_code_type> find( uint32_t rva ) const
+        {
+            auto it = std::upper_bound( rva_end.begin(), rva_end.end(), rva );
+            if ( it == rva_end.end() )
+                return std::nullopt;
+            size_t n = it - rva_end.begin();
+            if ( rva < rva_begin[ n ] )
+                return std::nullopt;
+            return types[ n ];
+        }
+        inline size_t size() const { return rva_begin.size(); }
+    };
+
+    // Guard function table (GFIDS), each entry is an RVA followed by the number of metadata bytes given by the guard flags.
+    //
+    struct guard_function_table_t
+    {
+        const uint8_t*              data = nullptr;
+        size_t                      count = 0;
+        size_t                      stride = sizeof( uint32_t );
+
+        struct entry_t
+        {
+            uint32_t                rva;
+            uint8_t                 flags;      // First metadata byte if any, see guard_fid_flags_t.
+            const uint8_t*          metadata;   // stride - 4 bytes.
+        };
+
+        // Random access iterator, entries are not aligned so they are decoded by value.
+        //
+        struct iterator
+        {
+            using iterator_category =   std::random_access_iterator_tag;
+            using difference_type =     ptrdiff_t;
+            using value_type =          entry_t;
+            using pointer =             void;
+            using reference =           entry_t;
+
+            const uint8_t*          at = nullptr;
+            size_t                  stride = sizeof( uint32_t );
+
+            inline entry_t operator*() const
+            {
+                entry_t entry = { 0, 0, at + sizeof( uint32_t ) };
+                memcpy( &entry.rva, at, sizeof( uint32_t ) );
+                if ( stride > sizeof( uint32_t ) ) entry.flags = at[ sizeof( uint32_t ) ];
+                return entry;
+            }
+            inline entry_t operator[]( difference_type n ) const { return *( *this + n ); }
+            inline iterator& operator+=( difference_type n ) { at += n * ptrdiff_t( stride ); return *this; }
+            inline iterator& operator-=( difference_type n ) { at -= n * ptrdiff_t( stride ); return *this; }
+            inline iterator operator+( difference_type n ) const { auto s = *this; return s += n; }
+            inline iterator operator-( difference_type n ) const { auto s = *this; return s -= n; }
+            inline difference_type operator-( const iterator& o ) const { return ( at - o.at ) / ptrdiff_t( stride ); }
+            inline iterator& operator++() { at += stride; return *this; }
+            inline iterator& operator--() { at -= stride; return *this; }
+            inline iterator operator++( int ) { auto s = *this; operator++(); return s; }
+            inline iterator operator--( int ) { auto s = *this; operator--(); return s; }
+            inline auto operator<=>( const iterator& o ) const { return at <=> o.at; }
+            inline bool operator==( const iterator& o ) const { return at == o.at; }
+        };
+
+        inline iterator begin() const { return { data, stride }; }
+        inline iterator end() const { return { data + count * stride, stride }; }
+        inline size_t size() const { return count; }
+        inline bool empty() const { return !count; }
+        inline entry_t operator[]( size_t n ) const { return begin()[ n ]; }
+
+        // Locates one of the guard tables of an image, all of which share the stride given by the guard flags.
+        // - Returns an empty table if the load config does not describe it or it is out of bounds.
+        //
+        template<bool x64>
+        static guard_function_table_t from_image( const image_t<x64>* image, guard_table_id_t id = guard_table_function )
+        {
+            return from_config( image, load_config_view_t<x64>::from_image( image ), id );
+        }
+        template<bool x64>
+        static guard_function_table_t from_config( const image_t<x64>* image, const load_config_view_t<x64>& config, guard_table_id_t id = guard_table_function )
+        {
+            using directory_t = load_config_directory_t<x64>;
+
+            // Pick the table and the flag indicating its presence.
+            //
+            std::optional<typename directory_t::table_t> desc;
+            std::optional<uint32_t> desc_rva;
+            uint32_t flag = 0;
+            switch ( id )
+            {
+                case guard_table_function:
+                    desc = config.template get<&directory_t::guard_cf_function_table>();
+                    desc_rva = config.template get_rva<&directory_t::guard_cf_function_table>();
+                    flag = guard_cf_function_table_present;
+                    break;
+                case guard_table_address_taken_iat:
+                    desc = config.template get<&directory_t::guard_address_taken_iat_entry_table>();
+                    desc_rva = config.template get_rva<&directory_t::guard_address_taken_iat_entry_table>();
+                    break;
+                case guard_table_long_jump:
+                    desc = config.template get<&directory_t::guard_long_jump_target_table>();
+                    desc_rva = config.template get_rva<&directory_t::guard_long_jump_target_table>();
+                    flag = guard_cf_longjump_table_present;
+                    break;
+                case guard_table_eh_continuation:
+                    desc = config.template get<&directory_t::guard_eh_continuation_table>();
+                    desc_rva = config.template get_rva<&directory_t::guard_eh_continuation_table>();
+                    flag = guard_eh_continuation_table_present;
+                    break;
+                default:
+                    return {};
+            }
+            auto guard_flags = config.template get<&directory_t::guard_flags>();
+            if ( !desc || !desc_rva || !guard_flags || ( *guard_flags & flag ) != flag || !desc->count )
+                return {};
+
+            guard_function_table_t table = {};
+            table.stride = sizeof( uint32_t ) + ( ( *guard_flags & guard_cf_function_table_size_mask ) >> guard_cf_function_table_size_shift );
+            table.count = size_t( desc->count );
+            if ( table.count > ( UINT32_MAX / table.stride ) )
+                return {};
+            table.data = image->template rva_to_ptr<uint8_t>( *desc_rva, table.count * table.stride );
+            if ( !table.data )
+                return {};
+            return table;
+        }
+    };
+
+    // Merged index over the guard tables, one sorted array of RVAs with the tables listing each and their metadata.
+    //
+    struct guard_target_index_t
+    {
+        std::vector<uint32_t>       rvas = {};
+        std::vector<uint8_t>        tables = {};    // guard_table_id_t mask.
+        std::vector<uint8_t>        flags = {};     // guard_fid_flags_t, combined across the tables.
+
+        template<bool x64>
+        static guard_target_index_t build( const image_t<x64>* image, uint8_t which = guard_table_all )
+        {
+            struct item_t { uint32_t rva; uint8_t table; uint8_t flags; };
+            std::vector<item_t> items;
+            auto config = load_config_view_t<x64>::from_image( image );
+            for ( uint8_t id = 1; id & guard_table_all; id <<= 1 )
+            {
+                if ( !( which & id ) )
+                    continue;
+                auto table = guard_function_table_t::from_config( image, config, guard_table_id_t( id ) );
+                items.reserve( items.size() + table.size() );
+                for ( auto entry : table )
+                    items.push_back( { entry.rva, id, entry.flags } );
+            }
+            std::sort( items.begin(), items.end(), [ ] ( const item_t& a, const item_t& b ) { return a.rva < b.rva; } );
+
+            guard_target_index_t index = {};
+            index.rvas.reserve( items.size() );
+            index.tables.reserve( items.size() );
+            index.flags.reserve( items.size() );
+            for ( auto& item : items )
+            {
+                if ( !index.rvas.empty() && index.rvas.back() == item.rva )
+                {
+                    index.tables.back() |= item.table;
+                    index.flags.back() |= item.flags;
+                    continue;
+                }
+                index.rvas.push_back( item.rva );
+                index.tables.push_back( item.table );
+                index.flags.push_back( item.flags );
+            }
+            return index;
+        }
+
+        // Returns the mask of tables listing the RVA, zero if none.
+        //
+        inline uint8_t lookup( uint32_t rva ) const
+        {
+            auto it = std::lower_bound( rvas.begin(), rvas.end(), rva );
+            return ( it != rvas.end() && *it == rva ) ? tables[ it - rvas.begin() ] : 0;
+        }
+        inline bool contains( uint32_t rva, uint8_t which = guard_table_all ) const { return ( lookup( rva ) & which ) != 0; }
+        inline size_t size() const { return rvas.size(); }
+    };
+
+    // Control flow guard target bitmap with one bit per 16-byte slot of the image.
+    // - A bit is set if a valid target starts exactly at the slot, targets not aligned to 16 bytes are kept in a sorted
+    //   side table as the OS bitmap uses a second bit per slot to describe those.
+    // - Suppressed targets are not valid unless explicitly included.
+    //
+    struct cfg_bitmap_t
+    {
+        std::vector<uint64_t>       bits = {};
+        std::vector<uint32_t>       unaligned = {};
+
+        static cfg_bitmap_t build( const guard_function_table_t& table, uint32_t image_size, bool include_suppressed = false )
+        {
+            cfg_bitmap_t result = {};
+            size_t slots = ( size_t( image_size ) + 15 ) / 16;
+            result.bits.assign( ( slots + 63 ) / 64, 0 );
+            for ( auto entry : table )
+            {
+                if ( !include_suppressed && ( entry.flags & ( guard_fid_suppressed | guard_fid_export_suppressed ) ) )
+                    continue;
+                if ( entry.rva >= image_size )
+                    continue;
+                if ( entry.rva & 15 )
+                    result.unaligned.push_back( entry.rva );
+                else
+                    result.bits[ entry.rva >> 10 ] |= 1ull << ( ( entry.rva >> 4 ) & 63 );
+            }
+            std::sort( result.unaligned.begin(), result.unaligned.end() );
+            result.unaligned.erase( std::unique( result.unaligned.begin(), result.unaligned.end() ), result.unaligned.end() );
+            return result;
+        }
+
+        // Whether the RVA is a valid indirect call target.
+        //
+        inline bool is_valid_target( uint32_t rva ) const
+        {
+            if ( rva & 15 )
+                return std::binary_search( unaligned.begin(), unaligned.end(), rva );
+            size_t word = rva >> 10;
+            return word < bits.size() && ( bits[ word ] >> ( ( rva >> 4 ) & 63 ) ) & 1;
+        }
+    };
+};
\ No newline at end of file
@@ -30,6 +30,10 @@
 #include <string>
 #include <string_view>
 #include <iterator>
+#include <algorithm>
+#include <optional>
+#include <span>
+#include <vector>
 #include "../../img_common.hpp"
 #include "../data_directories.hpp"
 
@@ -70,6 +74,26 @@ namespace win
         uint16_t                    length;
         wchar_t                     name[ VAR_LEN ];
         inline std::wstring_view view() const { return { name, length }; }
+
+        // UTF-16 code units, independent of the platform's wchar_t.
+        //
+        inline std::u16string_view units() const { return { ( const char16_t* ) ( ( const uint8_t* ) this + sizeof( uint16_t ) ), length }; }
+
+        // Ordinal comparison against a string of any code unit type.
+        //
+        template<typename Ch>
+        inline int compare( std::basic_string_view<Ch> other ) const
+        {
+            auto self = units();
+            size_t n = std::min( self.size(), other.size() );
+            for ( size_t i = 0; i != n; i++ )
+            {
+                uint32_t a = ( uint16_t ) self[ i ];
+                uint32_t b = ( std::make_unsigned_t<Ch> ) other[ i ];
+                if ( a != b ) return a < b ? -1 : 1;
+            }
+            return self.size() == other.size() ? 0 : ( self.size() < other.size() ? -1 : 1 );
+        }
     };
 
     // Data entry
@@ -125,6 +149,76 @@ namespace win
         inline const rsrc_data_t*            as_data( const rsrc_generic_t& entry ) const { return !entry.is_directory ? at<rsrc_data_t>( entry.offset ) : nullptr; }
         inline const rsrc_string_t*          get_name( const rsrc_generic_t& entry ) const { return entry.is_named ? at<rsrc_string_t>( entry.offset_name ) : nullptr; }
         inline const rsrc_directory_t*       as_directory( const rsrc_generic_t& entry ) const { return entry.is_directory ? at<rsrc_directory_t>( entry.offset ) : nullptr; }
+
+        // (Any level) Lookups using the sort order, returns num_entries() if not found.
+        // - Named entries come first sorted by name, followed by the identifiers sorted by value.
+        // - Every probe must lie between the values the search already narrowed to, if one does not the level is
+        //   known to be unsorted and the lookup falls back to a linear scan. Unsorted levels that look consistent
+        //   along the search path miss like they do for the loader, which searches the same way.
+        //
+        inline size_t find_id( uint16_t id ) const
+        {
+            size_t lo = num_named_entries, hi = num_entries();
+            int32_t lo_value = -1, hi_value = 0x10000;
+            bool consistent = true;
+            while ( lo < hi )
+            {
+                size_t mid = ( lo + hi ) / 2;
+                uint16_t value = entries[ mid ].identifier;
+                if ( entries[ mid ].is_named || value <= lo_value || value >= hi_value )
+                {
+                    consistent = false;
+                    break;
+                }
+                if ( value == id ) return mid;
+                if ( value < id ) lo = mid + 1, lo_value = value;
+                else              hi = mid, hi_value = value;
+            }
+
+            if ( !consistent )
+            {
+                for ( size_t i = 0; i != num_entries(); i++ )
+                    if ( !entries[ i ].is_named && entries[ i ].identifier == id )
+                        return i;
+            }
+            return num_entries();
+        }
+        template<typename Ch>
+        inline size_t find_name( std::basic_string_view<Ch> name, const rsrc_directory_t* root ) const
+        {
+            size_t lo = 0, hi = num_named_entries;
+            const rsrc_string_t* lo_value = nullptr;
+            const rsrc_string_t* hi_value = nullptr;
+            bool consistent = true;
+            while ( lo < hi )
+            {
+                size_t mid = ( lo + hi ) / 2;
+                if ( !entries[ mid ].is_named )
+                {
+                    consistent = false;
+                    break;
+                }
+                auto* value = root->get_name( entries[ mid ] );
+                int cmp = value->compare( name );
+                if ( cmp == 0 ) return mid;
+                if ( ( lo_value && lo_value->compare( value->units() ) >= 0 ) ||
+                     ( hi_value && hi_value->compare( value->units() ) <= 0 ) )
+                {
+                    consistent = false;
+                    break;
+                }
+                if ( cmp < 0 ) lo = mid + 1, lo_value = value;
+                else           hi = mid, hi_value = value;
+            }
+
+            if ( !consistent )
+            {
+                for ( size_t i = 0; i != num_entries(); i++ )
+                    if ( entries[ i ].is_named && root->get_name( entries[ i ] )->compare( name ) == 0 )
+                        return i;
+            }
+            return num_entries();
+        }
     };
 
     // Iterator type propagating reference to tree root
@@ -227,9 +321,15 @@ namespace win
                 if ( fn( it ) ) return it;
             return { .root = root, .level = nullptr, .idx = 0, .depth = rsrc_null };
         }
-        inline iterator                    find( uint16_t u_id ) const { return find_if( [ & ] ( const auto& it ) { return it.has_id() && it.id() == u_id; } ); }
+        inline iterator                    find_at( size_t n ) const
+        {
+            if ( n < size() ) return const_cast< iterator* >( this )->at( n );
+            return { .root = root, .level = nullptr, .idx = 0, .depth = rsrc_null };
+        }
+        inline iterator                    find( uint16_t u_id ) const { return find_at( size() ? directory()->find_id( u_id ) : 0 ); }
         inline iterator                    find( resource_id r_id ) const { return find( ( uint16_t ) r_id ); }
-        inline iterator                    find( std::wstring_view name ) const { return find_if( [ & ] ( const auto& it ) { return it.has_name() && it.name() == name; } ); }
+        inline iterator                    find( std::wstring_view name ) const { return find_at( size() ? directory()->find_name( name, root ) : 0 ); }
+        inline iterator                    find( std::u16string_view name ) const { return find_at( size() ? directory()->find_name( name, root ) : 0 ); }
         template<typename T> inline auto   operator[]( T&& v ) const { return find( std::forward<T>( v ) ); }
     };
 
@@ -275,9 +375,15 @@ namespace win
                 if ( fn( it ) )  return it;
             return { .root = &type_directory, .level = nullptr, .idx = 0, .depth = rsrc_null };
         }
-        inline const_iterator              find( uint16_t u_id ) const { return find_if( [ & ] ( const auto& it ) { return it.has_id() && it.id() == u_id; } ); }
+        inline const_iterator              find_at( size_t n ) const
+        {
+            if ( n < size() ) return at( n );
+            return { .root = &type_directory, .level = nullptr, .idx = 0, .depth = rsrc_null };
+        }
+        inline const_iterator              find( uint16_t u_id ) const { return find_at( type_directory.find_id( u_id ) ); }
         inline const_iterator              find( resource_id r_id ) const { return find( ( uint16_t ) r_id ); }
-        inline const_iterator              find( std::wstring_view name ) const { return find_if( [ & ] ( const auto& it ) { return it.has_name() && it.name() == name; } ); }
+        inline const_iterator              find( std::wstring_view name ) const { return find_at( type_directory.find_name( name, &type_directory ) ); }
+        inline const_iterator              find( std::u16string_view name ) const { return find_at( type_directory.find_name( name, &type_directory ) ); }
         template<typename T> inline auto   find( T&& v ) { return acquire( ( ( const resource_directory_t* ) this )->find( std::forward<T>( v ) ) ); }
         template<typename T> inline auto   find_if( T&& fn ) { return acquire( ( ( const resource_directory_t* ) this )->find_if( std::forward<T>( fn ) ) ); }
         template<typename T> inline auto   operator[]( T&& v ) { return acquire( ( ( const resource_directory_t* ) this )->find( std::forward<T>( v ) ) ); }
@@ -287,4 +393,185 @@ namespace win
 
     template<bool x64> struct directory_type<directory_id::directory_entry_resource, x64, void> { using type = resource_directory_t; };
 };
-#pragma pack(pop)
\ No newline at end of file
+#pragma pack(pop)
+
+namespace win
+{
+    // Resource key at any level of the tree, either an identifier or a UTF-16 name pointing into the image.
+    //
+    struct rsrc_key_t
+    {
+        const char16_t*             name = nullptr;
+        uint16_t                    value = 0;   // Identifier or the length of the name.
+
+        constexpr rsrc_key_t() = default;
+        constexpr rsrc_key_t( uint16_t id ) : value( id ) {}
+        constexpr rsrc_key_t( resource_id id ) : value( ( uint16_t ) id ) {}
+        constexpr rsrc_key_t( std::u16string_view name ) : name( name.data() ), value( ( uint16_t ) name.size() ) {}
+
+        inline bool                        is_named() const { return name != nullptr; }
+        inline std::u16string_view         view() const { return { name, value }; }
+
+        inline uint64_t hash() const
+        {
+            // FNV-1a over the code units, seeded differently for identifiers.
+            //
+            uint64_t h = is_named() ? 0xcbf29ce484222325 : 0x84222325cbf29ce4;
+            if ( is_named() )
+            {
+                for ( char16_t c : view() )
+                    h = ( h ^ c ) * 0x100000001b3;
+            }
+            h = ( h ^ value ) * 0x100000001b3;
+            return h ^ ( h >> 29 );
+        }
+        inline bool operator==( const rsrc_key_t& o ) const
+        {
+            if ( is_named() != o.is_named() || value != o.value )
+                return false;
+            return !is_named() || view() == o.view();
+        }
+    };
+
+    // Flattened index over the resource tree keyed by (type, name, language).
+    // - Built in a single pass into two flat arrays, names are not copied and point into the image.
+    // - Lookups hash (type, name) only so that any-language queries probe the same chain.
+    // - If the directory size is given, entries out of its bounds are skipped.
+    //
+    struct rsrc_index_t
+    {
+        struct entry_t
+        {
+            rsrc_key_t                  type;
+            rsrc_key_t                  name;
+            uint16_t                    lang;
+            uint32_t                    hash;
+            const rsrc_data_t*          data;
+        };
+        static constexpr uint32_t npos = UINT32_MAX;
+
+        std::vector<entry_t>        entries = {};   // In tree order.
+        std::vector<uint32_t>       slots = {};     // Open addressing over entries, power of two.
+
+        // Builds the index.
+        //
+        static rsrc_index_t build( const resource_directory_t* rsrc, size_t size = 0 )
+        {
+            rsrc_index_t index = {};
+            index.assign( rsrc, size );
+            return index;
+        }
+
+        // Rebuilds the index in place, reusing the previously allocated storage.
+        //
+        void assign( const resource_directory_t* rsrc, size_t size = 0 )
+        {
+            entries.clear();
+            slots.clear();
+            if ( !rsrc )
+                return;
+            const rsrc_directory_t* root = &rsrc->type_directory;
+
+            auto in_bounds = [ & ] ( uint32_t offset, size_t length )
+            {
+                return !size || ( offset <= size && length <= ( size - offset ) );
+            };
+            auto get_directory = [ & ] ( const rsrc_generic_t& e ) -> const rsrc_directory_t*
+            {
+                if ( !e.is_directory || !in_bounds( e.offset, offsetof( rsrc_directory_t, entries ) ) )
+                    return nullptr;
+                auto* dir = root->as_directory( e );
+                return in_bounds( e.offset, offsetof( rsrc_directory_t, entries ) + dir->num_entries() * sizeof( rsrc_generic_t ) ) ? dir : nullptr;
+            };
+            auto get_key = [ & ] ( const rsrc_generic_t& e, rsrc_key_t& key )
+            {
+                if ( !e.is_named )
+                {
+                    key = { e.identifier };
+                    return true;
+                }
+                if ( !in_bounds( e.offset_name, sizeof( uint16_t ) ) )
+                    return false;
+                auto* str = root->get_name( e );
+                if ( !in_bounds( e.offset_name, sizeof( uint16_t ) + str->length * sizeof( char16_t ) ) )
+                    return false;
+                key.name = str->units().data();
+                key.value = str->length;
+                return true;
+            };
+
+            if ( !in_bounds( 0, offsetof( rsrc_directory_t, entries ) + root->num_entries() * sizeof( rsrc_generic_t ) ) )
+                return;
+            for ( auto& te : std::span{ root->entries, root->num_entries() } )
+            {
+                rsrc_key_t type;
+                auto* names = get_directory( te );
+                if ( !names || !get_key( te, type ) )
+                    continue;
+                for ( auto& ne : std::span{ names->entries, names->num_entries() } )
+                {
+                    rsrc_key_t name;
+                    auto* langs = get_directory( ne );
+                    if ( !langs || !get_key( ne, name ) )
+                        continue;
+                    uint32_t hash = ( uint32_t ) ( type.hash() ^ ( name.hash() * 0x9e3779b97f4a7c15 >> 32 ) );
+                    for ( auto& le : std::span{ langs->entries, langs->num_entries() } )
+                    {
+                        if ( le.is_directory || le.is_named || !in_bounds( le.offset, sizeof( rsrc_data_t ) ) )
+                            continue;
+                        entries.push_back( { type, name, le.identifier, hash, root->as_data( le ) } );
+                    }
+                }
+            }
+
+            // Insert in tree order so that the first language of a chain is the one the tree lists first.
+            //
+            size_t capacity = 8;
+            while ( capacity < entries.size() * 2 )
+                capacity *= 2;
+            slots.assign( capacity, npos );
+            for ( uint32_t n = 0; n != entries.size(); n++ )
+            {
+                size_t i = entries[ n ].hash & ( capacity - 1 );
+                while ( slots[ i ] != npos )
+                    i = ( i + 1 ) & ( capacity - 1 );
+                slots[ i ] = n;
+            }
+        }
+
+        // Lookups, returns nullptr if not found.
+        //
+        const entry_t* find_entry( const rsrc_key_t& type, const rsrc_key_t& name, std::optional<uint16_t> lang = std::nullopt ) const
+        {
+            if ( slots.empty() )
+                return nullptr;
+            uint32_t hash = ( uint32_t ) ( type.hash() ^ ( name.hash() * 0x9e3779b97f4a7c15 >> 32 ) );
+            size_t mask = slots.size() - 1;
+            for ( size_t i = hash & mask; slots[ i ] != npos; i = ( i + 1 ) & mask )
+            {
+                const entry_t& e = entries[ slots[ i ] ];
+                if ( e.hash == hash && ( !lang || e.lang == *lang ) && e.type == type && e.name == name )
+                    return &e;
+            }
+            return nullptr;
+        }
+        const rsrc_data_t* find( const rsrc_key_t& type, const rsrc_key_t& name, std::optional<uint16_t> lang = std::nullopt ) const
+        {
+            auto* e = find_entry( type, name, lang );
+            return e ? e->data : nullptr;
+        }
+
+        // Enumerates all entries of the given type in tree order.
+        //
+        template<typename F>
+        void for_each( const rsrc_key_t& type, F&& fn ) const
+        {
+            for ( auto& e : entries )
+                if ( e.type == type )
+                    fn( e );
+        }
+
+        inline size_t size() const { return entries.size(); }
+        inline bool empty() const { return entries.empty(); }
+    };
+};
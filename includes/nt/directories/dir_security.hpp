@@ -26,6 +26,9 @@
 // POSSIBILITY OF SUCH DAMAGE.        
 //
 #pragma once
+#include <cstddef>
+#include <iterator>
+#include <span>
 #include "../../img_common.hpp"
 #include "../data_directories.hpp"
 
@@ -47,9 +50,99 @@ namespace win
         version_t            revision;
         certificate_type_id  certificate_type;
         uint8_t              raw_data[ VAR_LEN ];
+
+        // Certificate blob following the header, e.g. the PKCS#7 SignedData for pkcs_signed_data.
+        //
+        inline size_t data_size() const { return length > offsetof( win_certificate_t, raw_data ) ? length - offsetof( win_certificate_t, raw_data ) : 0; }
+        inline std::span<const uint8_t> data() const { return { raw_data, data_size() }; }
     };
     using security_directory_t = win_certificate_t;
 
     template<bool x64> struct directory_type<directory_id::directory_entry_security, x64, void> { using type = security_directory_t; };
 };
-#pragma pack(pop)
\ No newline at end of file
+#pragma pack(pop)
+
+namespace win
+{
+    // Certificate table, located by the security directory whose "rva" is a file offset.
+    // - Entries are 8-byte aligned, iteration stops at the first entry crossing the end of the table.
+    //
+    struct certificate_table_t
+    {
+        const uint8_t*              data = nullptr;
+        size_t                      size = 0;
+
+        // Forward iterator over the entries.
+        //
+        struct iterator
+        {
+            using iterator_category =   std::forward_iterator_tag;
+            using difference_type =     ptrdiff_t;
+            using value_type =          win_certificate_t;
+            using pointer =             const win_certificate_t*;
+            using reference =           const win_certificate_t&;
+
+            const uint8_t*          at = nullptr;
+            const uint8_t*          end = nullptr;
+
+            // Whether the entry at the current position fits the table.
+            //
+            inline bool is_valid() const
+            {
+                size_t limit = size_t( end - at );
+                if ( limit < offsetof( win_certificate_t, raw_data ) )
+                    return false;
+                auto* cert = ( const win_certificate_t* ) at;
+                return cert->length >= offsetof( win_certificate_t, raw_data ) && cert->length <= limit;
+            }
+            inline iterator& operator++()
+            {
+                size_t length = ( ( ( const win_certificate_t* ) at )->length + 7 ) & ~size_t( 7 );
+                at = length < size_t( end - at ) ? at + length : end;
+                if ( at != end && !is_valid() ) at = end;
+                return *this;
+            }
+            inline iterator operator++( int ) { auto s = *this; operator++(); return s; }
+            inline reference operator*() const { return *( const win_certificate_t* ) at; }
+            inline pointer operator->() const { return ( const win_certificate_t* ) at; }
+            inline bool operator==( const iterator& o ) const { return at == o.at; }
+            inline bool operator!=( const iterator& o ) const { return at != o.at; }
+        };
+
+        inline iterator begin() const
+        {
+            iterator it = { data, data + size };
+            if ( !it.is_valid() ) it.at = it.end;
+            return it;
+        }
+        inline iterator end() const { return { data + size, data + size }; }
+        inline bool empty() const { return begin() == end(); }
+
+        // Whether every entry is well formed up to the end of the table, allowing only for the alignment padding.
+        //
+        inline bool valid() const
+        {
+            if ( !data )
+                return false;
+            size_t covered = 0;
+            for ( auto it = begin(); it != end(); ++it )
+                covered = size_t( it.at - data ) + it->length;
+            return ( ( covered + 7 ) & ~size_t( 7 ) ) >= size;
+        }
+
+        // Locates the table within the raw file, returns an empty table if it is misaligned or out of bounds.
+        //
+        static certificate_table_t from_file( const void* file, size_t file_size, const data_directory_t& dir )
+        {
+            if ( !dir.present() || ( dir.rva & 7 ) || dir.rva > file_size || dir.size > ( file_size - dir.rva ) )
+                return {};
+            return { ( const uint8_t* ) file + dir.rva, dir.size };
+        }
+        template<typename Image>
+        static certificate_table_t from_image( const Image* image, size_t file_size )
+        {
+            auto* dir = image->get_directory( directory_entry_security );
+            return dir ? from_file( image, file_size, *dir ) : certificate_table_t{};
+        }
+    };
+};
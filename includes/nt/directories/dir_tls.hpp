@@ -26,6 +26,8 @@
 // POSSIBILITY OF SUCH DAMAGE.        
 //
 #pragma once
+#include <iterator>
+#include <span>
 #include "../../img_common.hpp"
 #include "../data_directories.hpp"
 
@@ -71,4 +73,144 @@ namespace win
 
     template<bool x64> struct directory_type<directory_id::directory_entry_tls, x64, void> { using type = tls_directory_t<x64>; };
 };
-#pragma pack(pop)
\ No newline at end of file
+#pragma pack(pop)
+
+namespace win
+{
+    template<bool x64> struct image_t;
+
+    // Range over the TLS callbacks as RVAs.
+    // - Iteration stops at the null terminator, at a callback outside the image or at an entry that cannot be read.
+    // - Mapped views translate RVAs directly, raw views through the section table.
+    //
+    template<bool x64 = default_architecture>
+    struct tls_callback_range_t
+    {
+        using va_t = std::conditional_t<x64, uint64_t, uint32_t>;
+
+        const image_t<x64>*         image = nullptr;
+        uint32_t                    rva_table = 0;         // Zero if there are no callbacks.
+        uint64_t                    image_base = 0;
+        uint32_t                    size_image = 0;
+        bool                        mapped = false;
+
+        // Reads the entry at the RVA, zero if it terminates the range.
+        //
+        inline uint32_t read( uint32_t rva ) const
+        {
+            if ( uint64_t( rva ) + sizeof( va_t ) > size_image )
+                return 0;
+            auto* entry = mapped
+                ? image->template raw_to_ptr<va_t>( rva )
+                : image->template rva_to_ptr<va_t>( rva, sizeof( va_t ) );
+            if ( !entry )
+                return 0;
+            va_t va = *entry;
+            if ( va <= image_base || ( va - image_base ) >= size_image )
+                return 0;
+            return uint32_t( va - image_base );
+        }
+
+        struct iterator
+        {
+            using iterator_category =   std::forward_iterator_tag;
+            using difference_type =     ptrdiff_t;
+            using value_type =          uint32_t;
+            using pointer =             const uint32_t*;
+            using reference =           const uint32_t&;
+
+            const tls_callback_range_t* range = nullptr;
+            uint32_t                at = 0;                // RVA of the entry, zero at the end.
+            uint32_t                value = 0;
+
+            inline void load()
+            {
+                if ( at && !( value = range->read( at ) ) )
+                    at = 0;
+            }
+            inline iterator& operator++()
+            {
+                at += sizeof( va_t );
+                load();
+                return *this;
+            }
+            inline iterator operator++( int ) { auto s = *this; operator++(); return s; }
+            inline reference operator*() const { return value; }
+            inline pointer operator->() const { return &value; }
+            inline bool operator==( const iterator& o ) const { return at == o.at; }
+            inline bool operator!=( const iterator& o ) const { return at != o.at; }
+        };
+
+        inline iterator begin() const
+        {
+            iterator it = { this, rva_table };
+            it.load();
+            return it;
+        }
+        inline iterator end() const { return { this, 0 }; }
+        inline bool empty() const { return begin() == end(); }
+        inline size_t size() const { return size_t( std::distance( begin(), end() ) ); }
+    };
+
+    // TLS directory with its addresses normalized.
+    // - raw_data is the template copied into each thread's block, followed by size_zero_fill zero bytes.
+    //
+    template<bool x64 = default_architecture>
+    struct tls_view_t
+    {
+        const tls_directory_t<x64>* directory = nullptr;
+        std::span<const uint8_t>    raw_data = {};
+        uint32_t                    size_zero_fill = 0;
+        tls_callback_range_t<x64>   callbacks = {};
+
+        inline bool present() const { return directory != nullptr; }
+        inline size_t block_size() const { return raw_data.size() + size_zero_fill; }
+
+        template<bool x>
+        static tls_view_t from_image( const image_t<x>* image, bool mapped = false )
+        {
+            static_assert( x == x64, "Architecture mismatch." );
+            tls_view_t view = {};
+            auto* nt = image->get_nt_headers();
+            uint64_t image_base = nt->optional_header.image_base;
+            uint32_t size_image = nt->optional_header.size_image;
+            view.callbacks = { image, 0, image_base, size_image, mapped };
+
+            auto* dir = image->get_directory( directory_entry_tls );
+            if ( !dir || dir->size < sizeof( tls_directory_t<x64> ) )
+                return view;
+            if ( uint64_t( dir->rva ) + sizeof( tls_directory_t<x64> ) > size_image )
+                return view;
+            view.directory = mapped
+                ? image->template raw_to_ptr<tls_directory_t<x64>>( dir->rva )
+                : image->template rva_to_ptr<tls_directory_t<x64>>( dir->rva, sizeof( tls_directory_t<x64> ) );
+            if ( !view.directory )
+                return view;
+            view.size_zero_fill = view.directory->size_zero_fill;
+
+            // Converts a VA to an RVA, zero if null or outside the image.
+            //
+            auto to_rva = [ & ] ( uint64_t va ) -> uint32_t
+            {
+                if ( va <= image_base || ( va - image_base ) >= size_image )
+                    return 0;
+                return uint32_t( va - image_base );
+            };
+            view.callbacks.rva_table = to_rva( view.directory->address_callbacks );
+
+            // Template data may end exactly at the end of the image.
+            //
+            uint64_t start = view.directory->address_raw_data_start, end = view.directory->address_raw_data_end;
+            if ( uint32_t rva = to_rva( start ); rva && end > start && ( end - image_base ) <= size_image )
+            {
+                size_t length = size_t( end - start );
+                auto* data = mapped
+                    ? image->template raw_to_ptr<uint8_t>( rva )
+                    : image->template rva_to_ptr<uint8_t>( rva, length );
+                if ( data )
+                    view.raw_data = { data, length };
+            }
+            return view;
+        }
+    };
+};
\ No newline at end of file
@@ -0,0 +1,218 @@
+// Copyright (c) 2020 Can Boluk
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include "../img_common.hpp"
+#include "../coff/symbol.hpp"
+#include "image.hpp"
+
+namespace win
+{
+	// Sources a function boundary can be discovered from.
+	//
+	enum function_source_t : uint8_t
+	{
+		function_source_pdata =     1 << 0,    // Exception directory entry.
+		function_source_export =    1 << 1,    // Exported function.
+		function_source_symbol =    1 << 2,    // COFF function symbol.
+	};
+
+	// Sorted map of function boundaries in structure of arrays layout.
+	// - Ends not described by the exception directory extend to the next function or the end of the section.
+	// - Entries do not overlap, an end is clipped to the start of the next function.
+	//
+	struct function_map_t
+	{
+		static constexpr size_t npos = SIZE_MAX;
+
+		std::vector<uint32_t>       rva_begin = {};
+		std::vector<uint32_t>       rva_end = {};
+		std::vector<uint8_t>        sources = {};
+
+		// Basic properties.
+		//
+		size_t size() const { return rva_begin.size(); }
+		bool empty() const { return rva_begin.empty(); }
+
+		// Returns the index of the function containing the RVA or npos.
+		//
+		size_t find_containing( uint32_t rva ) const
+		{
+			size_t n = size_t( std::upper_bound( rva_begin.begin(), rva_begin.end(), rva ) - rva_begin.begin() );
+			if ( !n || rva >= rva_end[ n - 1 ] )
+				return npos;
+			return n - 1;
+		}
+
+		// Returns the index of the first function starting after the RVA or npos.
+		//
+		size_t find_next( uint32_t rva ) const
+		{
+			size_t n = size_t( std::upper_bound( rva_begin.begin(), rva_begin.end(), rva ) - rva_begin.begin() );
+			return n == size() ? npos : n;
+		}
+
+		// Builds the map from the exception directory, exports and the COFF symbol table of a raw image.
+		// - Symbol table is past the sections so it is only read if the size of the raw view is given.
+		// - Each source is collected on its own thread if parallel is set.
+		//
+		template<bool x64>
+		static function_map_t build( const image_t<x64>* image, size_t raw_size = 0, bool parallel = true )
+		{
+			struct entry_t
+			{
+				uint32_t            rva_begin;
+				uint32_t            rva_end;
+				uint8_t             sources;
+			};
+			std::vector<entry_t> collected[ 3 ];
+
+			// Exception directory, only describes x64 images.
+			//
+			auto collect_pdata = [ & ] ()
+			{
+				if constexpr ( x64 )
+				{
+					auto dir = image->get_directory( directory_entry_exception );
+					if ( !dir ) return;
+					auto* table = image->template rva_to_ptr<runtime_function_t>( dir->rva, dir->size );
+					if ( !table ) return;
+
+					exception_directory functions{ table, dir->size };
+					collected[ 0 ].reserve( functions.size() );
+					for ( auto& fn : functions )
+						if ( fn.rva_begin < fn.rva_end )
+							collected[ 0 ].push_back( { fn.rva_begin, fn.rva_end, function_source_pdata } );
+				}
+			};
+
+			// Exported functions, forwarders point into the export directory itself and data exports into
+			// non-executable sections.
+			//
+			auto collect_exports = [ & ] ()
+			{
+				auto dir = image->get_directory( directory_entry_export );
+				if ( !dir ) return;
+				auto* exports = image->template rva_to_ptr<export_directory_t>( dir->rva, sizeof( export_directory_t ) );
+				if ( !exports ) return;
+				auto* functions = image->template rva_to_ptr<uint32_t>( exports->rva_functions, exports->num_functions * sizeof( uint32_t ) );
+				if ( !functions ) return;
+
+				collected[ 1 ].reserve( exports->num_functions );
+				for ( size_t n = 0; n != exports->num_functions; n++ )
+				{
+					uint32_t rva = functions[ n ];
+					if ( !rva || ( dir->rva <= rva && rva < ( dir->rva + dir->size ) ) )
+						continue;
+					auto* scn = image->rva_to_section( rva );
+					if ( scn && scn->characteristics.mem_execute )
+						collected[ 1 ].push_back( { rva, 0, function_source_export } );
+				}
+			};
+
+			// COFF symbols with a function type.
+			//
+			auto collect_symbols = [ & ] ()
+			{
+				auto* file_header = &image->get_nt_headers()->file_header;
+				if ( !file_header->ptr_symbols || !file_header->num_symbols ) return;
+				if ( file_header->ptr_symbols > raw_size || ( raw_size - file_header->ptr_symbols ) / sizeof( coff::symbol_t ) < file_header->num_symbols ) return;
+				auto* symbols = image->template raw_to_ptr<coff::symbol_t>( file_header->ptr_symbols );
+
+				auto* nt_hdrs = image->get_nt_headers();
+				for ( size_t n = 0; n < file_header->num_symbols; n += 1 + symbols[ n ].num_auxiliary )
+				{
+					auto& sym = symbols[ n ];
+					if ( sym.derived_type != coff::derived_type_id::function || !sym.has_section() )
+						continue;
+					auto* scn = nt_hdrs->get_section( sym.section_index - 1 );
+					if ( scn )
+						collected[ 2 ].push_back( { scn->virtual_address + uint32_t( sym.value ), 0, function_source_symbol } );
+				}
+			};
+
+			if ( parallel )
+			{
+				std::thread workers[] = { std::thread( collect_pdata ), std::thread( collect_exports ) };
+				collect_symbols();
+				for ( auto& worker : workers )
+					worker.join();
+			}
+			else
+			{
+				collect_pdata();
+				collect_exports();
+				collect_symbols();
+			}
+
+			// Merge the sources, entries starting at the same RVA are combined.
+			//
+			std::vector<entry_t> entries;
+			entries.reserve( collected[ 0 ].size() + collected[ 1 ].size() + collected[ 2 ].size() );
+			for ( auto& source : collected )
+				entries.insert( entries.end(), source.begin(), source.end() );
+			std::sort( entries.begin(), entries.end(), [ ] ( const entry_t& a, const entry_t& b ) { return a.rva_begin < b.rva_begin; } );
+
+			function_map_t result;
+			result.rva_begin.reserve( entries.size() );
+			result.rva_end.reserve( entries.size() );
+			result.sources.reserve( entries.size() );
+			for ( auto& entry : entries )
+			{
+				if ( !result.empty() && result.rva_begin.back() == entry.rva_begin )
+				{
+					result.rva_end.back() = std::max( result.rva_end.back(), entry.rva_end );
+					result.sources.back() |= entry.sources;
+					continue;
+				}
+				result.rva_begin.push_back( entry.rva_begin );
+				result.rva_end.push_back( entry.rva_end );
+				result.sources.push_back( entry.sources );
+			}
+
+			// Resolve the unknown ends and clip the known ones to the next function so that entries never overlap.
+			//
+			for ( size_t n = 0; n != result.size(); n++ )
+			{
+				uint32_t limit = result.rva_end[ n ];
+				if ( !limit )
+				{
+					limit = UINT32_MAX;
+					if ( auto* scn = image->rva_to_section( result.rva_begin[ n ] ) )
+						limit = scn->virtual_address + std::max( scn->virtual_size, scn->size_raw_data );
+				}
+				if ( ( n + 1 ) != result.size() )
+					limit = std::min( limit, result.rva_begin[ n + 1 ] );
+				result.rva_end[ n ] = std::max( limit, result.rva_begin[ n ] + 1 );
+			}
+			return result;
+		}
+	};
+};
@@ -0,0 +1,321 @@
+// Copyright (c) 2020 Can Boluk
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <vector>
+#include "../img_common.hpp"
+#include "directories/dir_exceptions.hpp"
+
+namespace win
+{
+	// Encoder for the unwind information of common prologues.
+	// - Operations are added in prologue order, offsets are the end of the instruction within the prologue.
+	// - Operations return false if the described operation is not encodable.
+	//
+	struct amd64_unwind_info_builder_t
+	{
+		// Codes grouped by operation in prologue order.
+		//
+		std::vector<std::vector<unwind_code_t>> operations = {};
+		uint8_t                     size_prologue = 0;
+		unwind_register_id          frame_register = {};
+		uint8_t                     frame_offset = 0;
+
+		// Language specific data.
+		//
+		bool                        ex_handler = false;
+		bool                        term_handler = false;
+		uint32_t                    handler_rva = 0;
+		std::vector<uint8_t>        handler_data = {};
+		std::optional<runtime_function_t> chained = std::nullopt;
+
+		// Prologue operations.
+		//
+		bool push_nonvol( uint8_t offset, unwind_register_id reg )
+		{
+			if ( size_t( reg ) > size_t( unwind_register_id::amd64_r15 ) )
+				return false;
+			return add( offset, unwind_opcode::push_nonvol, uint8_t( reg ) );
+		}
+		bool alloc( uint8_t offset, uint32_t size )
+		{
+			if ( !size || size % 8 )
+				return false;
+			if ( size <= 128 )
+				return add( offset, unwind_opcode::alloc_small, uint8_t( size / 8 - 1 ) );
+			if ( size <= ( 0xFFFF * 8 ) )
+				return add( offset, unwind_opcode::alloc_large, 0, { uint16_t( size / 8 ) } );
+			return add( offset, unwind_opcode::alloc_large, 1, { uint16_t( size ), uint16_t( size >> 16 ) } );
+		}
+		bool set_frame( uint8_t offset, unwind_register_id reg, uint32_t sp_offset )
+		{
+			if ( size_t( reg ) > size_t( unwind_register_id::amd64_r15 ) || sp_offset % 16 || sp_offset > 240 )
+				return false;
+			if ( !add( offset, unwind_opcode::set_frame, 0 ) )
+				return false;
+			frame_register = reg;
+			frame_offset = uint8_t( sp_offset / 16 );
+			return true;
+		}
+		bool save_nonvol( uint8_t offset, unwind_register_id reg, uint32_t sp_offset )
+		{
+			if ( size_t( reg ) > size_t( unwind_register_id::amd64_r15 ) || sp_offset % 8 )
+				return false;
+			if ( sp_offset <= ( 0xFFFF * 8 ) )
+				return add( offset, unwind_opcode::save_nonvol, uint8_t( reg ), { uint16_t( sp_offset / 8 ) } );
+			return add( offset, unwind_opcode::save_nonvol_far, uint8_t( reg ), { uint16_t( sp_offset ), uint16_t( sp_offset >> 16 ) } );
+		}
+		bool save_xmm128( uint8_t offset, uint8_t xmm_index, uint32_t sp_offset )
+		{
+			if ( xmm_index > 15 || sp_offset % 16 )
+				return false;
+			if ( sp_offset <= ( 0xFFFF * 16 ) )
+				return add( offset, unwind_opcode::save_xmm128, xmm_index, { uint16_t( sp_offset / 16 ) } );
+			return add( offset, unwind_opcode::save_xmm128_far, xmm_index, { uint16_t( sp_offset ), uint16_t( sp_offset >> 16 ) } );
+		}
+		bool push_machframe( uint8_t offset, bool error_code )
+		{
+			return add( offset, unwind_opcode::push_machframe, error_code ? 1 : 0 );
+		}
+
+		// Size of the encoded record.
+		//
+		size_t size() const
+		{
+			size_t num_codes = 0;
+			for ( auto& op : operations )
+				num_codes += op.size();
+			size_t length = offsetof( unwind_info_t, unwind_code ) + ( ( num_codes + 1 ) & ~1 ) * sizeof( unwind_code_t );
+			if ( chained )
+				length += sizeof( runtime_function_t );
+			else if ( ex_handler || term_handler )
+				length += sizeof( uint32_t ) + handler_data.size();
+			return length;
+		}
+
+		// Encodes the record into the buffer which should be at least size() bytes, returns false if not encodable.
+		//
+		bool encode_to( void* out ) const
+		{
+			size_t num_codes = 0;
+			for ( auto& op : operations )
+				num_codes += op.size();
+			if ( num_codes > 0xFF )
+				return false;
+
+			memset( out, 0, size() );
+			auto* info = ( unwind_info_t* ) out;
+			info->version = 1;
+			info->ex_handler = !chained && ex_handler;
+			info->term_handler = !chained && term_handler;
+			info->chained = chained.has_value();
+			info->size_prologue = size_prologue;
+			info->num_uw_codes = uint8_t( num_codes );
+			info->frame_register = frame_register;
+			info->frame_offset = frame_offset;
+
+			// Codes are stored in the reverse order of the prologue.
+			//
+			unwind_code_t* it = info->unwind_code;
+			for ( auto op = operations.rbegin(); op != operations.rend(); ++op )
+				it = std::copy( op->begin(), op->end(), it );
+
+			if ( chained )
+			{
+				info->chained_function_entry() = *chained;
+			}
+			else if ( ex_handler || term_handler )
+			{
+				info->exception_handler_rva() = handler_rva;
+				if ( !handler_data.empty() )
+					memcpy( info->exception_specific_data(), handler_data.data(), handler_data.size() );
+			}
+			return true;
+		}
+		std::vector<uint8_t> encode() const
+		{
+			std::vector<uint8_t> result( size() );
+			if ( !encode_to( result.data() ) )
+				result.clear();
+			return result;
+		}
+
+	private:
+		bool add( uint8_t offset, unwind_opcode op, uint8_t op_info, std::initializer_list<uint16_t> operands = {} )
+		{
+			if ( offset < size_prologue || op_info > 0xF )
+				return false;
+			size_prologue = offset;
+
+			auto& codes = operations.emplace_back();
+			unwind_code_t code = {};
+			code.code_offset = offset;
+			code.unwind_op = op;
+			code.op_info = op_info;
+			codes.push_back( code );
+			for ( uint16_t operand : operands )
+				codes.push_back( std::bit_cast< unwind_code_t >( operand ) );
+			return true;
+		}
+	};
+
+	// Growable function table for dynamically generated code, akin to RtlAddGrowableFunctionTable.
+	// - Readers never lock, the table is published in generations that are only appended to.
+	// - Appends past the end of the last entry are done in place, others publish a new sorted generation.
+	// - Replaced generations are kept alive until the table is destroyed or reclaim() is called.
+	//
+	struct growable_function_table_t
+	{
+		struct generation_t
+		{
+			std::unique_ptr<runtime_function_t[]> entries;
+			size_t                                capacity = 0;
+			std::atomic<size_t>                   count = 0;
+		};
+
+		uint64_t                                   range_base = 0;     // Base address the entries are relative to.
+		std::atomic<generation_t*>                 current = nullptr;
+		std::vector<std::unique_ptr<generation_t>> generations = {};
+		std::mutex                                 write_lock = {};
+
+		// Constructed with the base address and the initial capacity.
+		//
+		growable_function_table_t( uint64_t range_base = 0, size_t capacity = 64 ) : range_base( range_base )
+		{
+			current.store( allocate( std::max<size_t>( capacity, 1 ) ), std::memory_order_release );
+		}
+		growable_function_table_t( const growable_function_table_t& ) = delete;
+		growable_function_table_t& operator=( const growable_function_table_t& ) = delete;
+
+		// Returns a consistent view of the current table, valid until the table is destroyed or reclaimed.
+		//
+		exception_directory snapshot() const
+		{
+			generation_t* gen = current.load( std::memory_order_acquire );
+			size_t count = gen->count.load( std::memory_order_acquire );
+			return { gen->entries.get(), count * sizeof( runtime_function_t ) };
+		}
+
+		// Lookups.
+		//
+		const runtime_function_t* find_overlapping( uint32_t rva ) const
+		{
+			auto view = snapshot();
+			auto it = view.find_overlapping( rva );
+			return it != view.end() ? it : nullptr;
+		}
+		const runtime_function_t* find_address( uint64_t address ) const
+		{
+			if ( address < range_base || ( address - range_base ) > UINT32_MAX )
+				return nullptr;
+			return find_overlapping( uint32_t( address - range_base ) );
+		}
+
+		// Appends a batch of entries.
+		// - Returns false and appends nothing if any entry is empty or overlaps another entry of the batch or the table.
+		//
+		bool append( std::span<const runtime_function_t> batch )
+		{
+			if ( batch.empty() )
+				return true;
+			std::vector<runtime_function_t> sorted( batch.begin(), batch.end() );
+			std::sort( sorted.begin(), sorted.end(), exception_directory::key_compare_end{} );
+			for ( size_t n = 0; n != sorted.size(); n++ )
+			{
+				if ( sorted[ n ].rva_begin >= sorted[ n ].rva_end )
+					return false;
+				if ( n && sorted[ n - 1 ].rva_end > sorted[ n ].rva_begin )
+					return false;
+			}
+
+			std::lock_guard _g{ write_lock };
+			generation_t* gen = current.load( std::memory_order_relaxed );
+			size_t count = gen->count.load( std::memory_order_relaxed );
+
+			// Check the batch against its neighbours in the current generation, the entries are disjoint so any entry
+			// overlapping the batch ends past its start and begins before its end.
+			//
+			const runtime_function_t* first = gen->entries.get();
+			const runtime_function_t* last = first + count;
+			auto it = std::upper_bound( first, last, sorted.front().rva_begin, [ ] ( uint32_t rva, const runtime_function_t& e ) { return rva < e.rva_end; } );
+			for ( auto& entry : sorted )
+			{
+				while ( it != last && it->rva_end <= entry.rva_begin )
+					++it;
+				if ( it != last && it->rva_begin < entry.rva_end )
+					return false;
+			}
+
+			// If the batch fits after the last entry, write it in place and publish the new count.
+			//
+			if ( ( count + sorted.size() ) <= gen->capacity && ( !count || gen->entries[ count - 1 ].rva_end <= sorted.front().rva_begin ) )
+			{
+				std::copy( sorted.begin(), sorted.end(), gen->entries.get() + count );
+				gen->count.store( count + sorted.size(), std::memory_order_release );
+				return true;
+			}
+
+			// Otherwise publish a new generation with the merged entries.
+			//
+			size_t capacity = gen->capacity;
+			if ( ( count + sorted.size() ) > capacity )
+				capacity = std::max( capacity * 2, count + sorted.size() );
+			generation_t* next = allocate( capacity );
+			std::merge( gen->entries.get(), gen->entries.get() + count, sorted.begin(), sorted.end(), next->entries.get(), exception_directory::key_compare_end{} );
+			next->count.store( count + sorted.size(), std::memory_order_relaxed );
+			current.store( next, std::memory_order_release );
+			return true;
+		}
+		bool append( const runtime_function_t& entry ) { return append( std::span{ &entry, 1 } ); }
+
+		// Frees the replaced generations, caller must guarantee no reader is using a previous snapshot.
+		//
+		void reclaim()
+		{
+			std::lock_guard _g{ write_lock };
+			generation_t* gen = current.load( std::memory_order_relaxed );
+			std::erase_if( generations, [ & ] ( const auto& g ) { return g.get() != gen; } );
+		}
+
+	private:
+		generation_t* allocate( size_t capacity )
+		{
+			auto& gen = generations.emplace_back( std::make_unique<generation_t>() );
+			gen->entries = std::make_unique<runtime_function_t[]>( capacity );
+			gen->capacity = capacity;
+			return gen.get();
+		}
+	};
+};
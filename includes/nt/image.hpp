@@ -75,7 +75,7 @@ namespace win {
 			//
 			uint16_t presult = chksum + ( chksum >> 16 );
 			if ( file_len & 1 )
-				presult += *( ( ( const char* ) this ) + file_len - 1 );
+				presult += *( ( ( const uint8_t* ) this ) + file_len - 1 );
 
 			// Adjust for the previous .checkum field (=0)
 			//
@@ -0,0 +1,257 @@
+// Copyright (c) 2020 Can Boluk
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <optional>
+#include <vector>
+#include "../img_common.hpp"
+#include "image.hpp"
+#include "authenticode.hpp"
+
+namespace win
+{
+	// Results a scan can produce, selected at compile time.
+	//
+	enum scan_feature_t : uint32_t
+	{
+		scan_checksum =             1 << 0,    // Optional header checksum, as compute_checksum.
+		scan_authenticode =         1 << 1,    // Authenticode digest.
+		scan_section_hashes =       1 << 2,    // Digest of each section's raw data.
+		scan_entropy =              1 << 3,    // Shannon entropy of the file and each section.
+		scan_all =                  0xF,
+	};
+
+	template<typename H>
+	struct image_scan_t
+	{
+		uint32_t                    checksum = 0;
+		std::optional<typename H::digest_t> authenticode = std::nullopt;
+		std::vector<typename H::digest_t> section_digests = {};   // In section header order.
+		double                      entropy = 0;                   // Bits per byte.
+		std::vector<double>         section_entropy = {};          // In section header order.
+	};
+
+	namespace impl
+	{
+		inline double shannon_entropy( const uint64_t* histogram, uint64_t total )
+		{
+			if ( !total )
+				return 0;
+			double result = 0;
+			for ( size_t i = 0; i != 256; i++ )
+			{
+				if ( !histogram[ i ] ) continue;
+				double p = double( histogram[ i ] ) / double( total );
+				result -= p * std::log2( p );
+			}
+			return result;
+		}
+	};
+
+	// Produces the selected results in a single sweep over the raw image.
+	// - The file is walked in cache sized chunks, each chunk is handed to every consumer before moving on.
+	// - Section ranges are clamped to the file, bytes of overlapping sections count towards the entropy of the first.
+	// - If the Authenticode ranges are not in file order, which only happens with out of order headers or overlapping
+	//   sections, the digest is computed with a separate pass instead.
+	//
+	static constexpr size_t scan_chunk_size = 64 * 1024;
+
+	template<uint32_t Features, typename H = sha256_t, bool x64>
+	inline image_scan_t<H> scan_image( const image_t<x64>* image, size_t file_size )
+	{
+		image_scan_t<H> result = {};
+		auto* base = ( const uint8_t* ) image;
+		auto* nt_hdrs = image->get_nt_headers();
+		size_t num_sections = nt_hdrs->file_header.num_sections;
+
+		// Section ranges clamped to the file.
+		//
+		struct range_t { size_t begin, end; };
+		std::vector<range_t> sections( num_sections );
+		for ( size_t i = 0; i != num_sections; i++ )
+		{
+			auto* scn = nt_hdrs->get_section( i );
+			size_t begin = std::min<size_t>( scn->ptr_raw_data, file_size );
+			sections[ i ] = { begin, scn->size_raw_data ? std::min<size_t>( begin + scn->size_raw_data, file_size ) : begin };
+		}
+
+		// Authenticode ranges, fused only if monotonic.
+		//
+		std::vector<range_t> auth_ranges;
+		H auth_hasher;
+		bool auth_valid = false, auth_fused = false;
+		if constexpr ( ( Features & scan_authenticode ) != 0 )
+		{
+			auth_valid = for_each_authenticode_range( image, file_size, [ & ] ( size_t offset, size_t length )
+			{
+				if ( length ) auth_ranges.push_back( { offset, offset + length } );
+			} );
+			auth_fused = auth_valid;
+			for ( size_t i = 1; auth_fused && i < auth_ranges.size(); i++ )
+				auth_fused = auth_ranges[ i - 1 ].end <= auth_ranges[ i ].begin;
+		}
+		size_t auth_next = 0;
+
+		// Entropy attribution, disjoint segments in file order each owned by a section or none.
+		//
+		struct segment_t { size_t begin, end, owner; };
+		std::vector<segment_t> segments;
+		std::vector<uint64_t> histograms;
+		if constexpr ( ( Features & scan_entropy ) != 0 )
+		{
+			std::vector<size_t> order( num_sections );
+			for ( size_t i = 0; i != num_sections; i++ ) order[ i ] = i;
+			std::stable_sort( order.begin(), order.end(), [ & ] ( size_t a, size_t b ) { return sections[ a ].begin < sections[ b ].begin; } );
+
+			size_t at = 0;
+			for ( size_t i : order )
+			{
+				size_t begin = std::max( at, sections[ i ].begin ), end = sections[ i ].end;
+				if ( begin >= end ) continue;
+				if ( at < begin ) segments.push_back( { at, begin, num_sections } );
+				segments.push_back( { begin, end, i } );
+				at = end;
+			}
+			if ( at < file_size ) segments.push_back( { at, file_size, num_sections } );
+			histograms.assign( ( num_sections + 1 ) * 256, 0 );
+		}
+		size_t segment_next = 0;
+
+		std::vector<H> section_hashers;
+		if constexpr ( ( Features & scan_section_hashes ) != 0 )
+			section_hashers.resize( num_sections );
+
+		uint64_t word_sum = 0;
+
+		// Sweep.
+		//
+		for ( size_t chunk = 0; chunk < file_size; chunk += scan_chunk_size )
+		{
+			size_t chunk_end = std::min( chunk + scan_chunk_size, file_size );
+
+			if constexpr ( ( Features & scan_checksum ) != 0 )
+			{
+				size_t words = ( chunk_end - chunk ) / 2;
+				const uint8_t* it = base + chunk;
+				uint64_t sum = 0;
+				for ( size_t n = 0; n != words; n++ )
+				{
+					uint16_t w;
+					memcpy( &w, it + n * 2, sizeof( w ) );
+					sum += w;
+				}
+				word_sum += sum;
+			}
+			if constexpr ( ( Features & scan_authenticode ) != 0 )
+			{
+				while ( auth_fused && auth_next != auth_ranges.size() && auth_ranges[ auth_next ].begin < chunk_end )
+				{
+					auto& r = auth_ranges[ auth_next ];
+					size_t begin = std::max( r.begin, chunk ), end = std::min( r.end, chunk_end );
+					auth_hasher.update( base + begin, end - begin );
+					if ( r.end > chunk_end ) break;
+					auth_next++;
+				}
+			}
+			if constexpr ( ( Features & scan_section_hashes ) != 0 )
+			{
+				for ( size_t i = 0; i != num_sections; i++ )
+				{
+					size_t begin = std::max( sections[ i ].begin, chunk ), end = std::min( sections[ i ].end, chunk_end );
+					if ( begin < end )
+						section_hashers[ i ].update( base + begin, end - begin );
+				}
+			}
+			if constexpr ( ( Features & scan_entropy ) != 0 )
+			{
+				while ( segment_next != segments.size() && segments[ segment_next ].begin < chunk_end )
+				{
+					auto& s = segments[ segment_next ];
+					uint64_t* histogram = &histograms[ s.owner * 256 ];
+					size_t begin = std::max( s.begin, chunk ), end = std::min( s.end, chunk_end );
+					for ( size_t n = begin; n != end; n++ )
+						histogram[ base[ n ] ]++;
+					if ( s.end > chunk_end ) break;
+					segment_next++;
+				}
+			}
+		}
+
+		// Finalize.
+		//
+		if constexpr ( ( Features & scan_checksum ) != 0 )
+		{
+			// Same as the folding in compute_checksum, which leaves the word sum in [1, 0xFFFF] unless it is zero.
+			//
+			uint16_t presult = word_sum ? uint16_t( ( word_sum - 1 ) % 0xFFFF + 1 ) : 0;
+			if ( file_size & 1 )
+				presult += base[ file_size - 1 ];
+			const uint16_t* adjust_sum = ( const uint16_t* ) &nt_hdrs->optional_header.checksum;
+			for ( size_t i = 0; i != 2; i++ )
+			{
+				presult -= presult < adjust_sum[ i ];
+				presult -= adjust_sum[ i ];
+			}
+			result.checksum = presult + ( uint32_t ) file_size;
+		}
+		if constexpr ( ( Features & scan_authenticode ) != 0 )
+		{
+			if ( auth_fused )
+				result.authenticode = auth_hasher.finalize();
+			else if ( auth_valid )
+				result.authenticode = authenticode_digest<H>( image, file_size );
+		}
+		if constexpr ( ( Features & scan_section_hashes ) != 0 )
+		{
+			result.section_digests.reserve( num_sections );
+			for ( auto& hasher : section_hashers )
+				result.section_digests.push_back( hasher.finalize() );
+		}
+		if constexpr ( ( Features & scan_entropy ) != 0 )
+		{
+			uint64_t total[ 256 ] = {};
+			result.section_entropy.resize( num_sections );
+			for ( size_t i = 0; i != ( num_sections + 1 ); i++ )
+			{
+				const uint64_t* histogram = &histograms[ i * 256 ];
+				uint64_t count = 0;
+				for ( size_t n = 0; n != 256; n++ )
+				{
+					count += histogram[ n ];
+					total[ n ] += histogram[ n ];
+				}
+				if ( i != num_sections )
+					result.section_entropy[ i ] = impl::shannon_entropy( histogram, count );
+			}
+			result.entropy = impl::shannon_entropy( total, file_size );
+		}
+		return result;
+	}
+};
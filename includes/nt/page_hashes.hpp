@@ -0,0 +1,177 @@
+// Copyright (c) 2020 Can Boluk
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <algorithm>
+#include <optional>
+#include <thread>
+#include <vector>
+#include "../img_common.hpp"
+#include "image.hpp"
+#include "authenticode.hpp"
+
+namespace win
+{
+	static constexpr size_t page_hash_page_size = 0x1000;
+
+	// Page hashes as carried by the page hash attribute of a signature.
+	// - First entry covers the headers without the checksum and the security directory entry.
+	// - Followed by each page of each section's raw data in section header order, zero padded to the page size.
+	// - Terminated by an entry with the end offset of the last section and a zero digest.
+	//
+	template<typename H = sha256_t>
+	struct page_hash_table_t
+	{
+		using digest_t = typename H::digest_t;
+		struct entry_t
+		{
+			uint32_t                offset;
+			digest_t                digest;
+		};
+		static constexpr size_t npos = SIZE_MAX;
+
+		std::vector<entry_t>        entries = {};
+
+		// Serializes into the attribute format, each entry as the little endian offset followed by the digest.
+		//
+		std::vector<uint8_t> serialize() const
+		{
+			std::vector<uint8_t> result( entries.size() * ( sizeof( uint32_t ) + sizeof( digest_t ) ) );
+			uint8_t* it = result.data();
+			for ( auto& entry : entries )
+			{
+				for ( size_t i = 0; i != sizeof( uint32_t ); i++ )
+					*it++ = uint8_t( entry.offset >> ( i * 8 ) );
+				it = std::copy( entry.digest.begin(), entry.digest.end(), it );
+			}
+			return result;
+		}
+
+		// Returns the index of the first entry that differs, npos if identical.
+		//
+		size_t find_mismatch( const page_hash_table_t& other ) const
+		{
+			size_t count = std::min( entries.size(), other.entries.size() );
+			for ( size_t i = 0; i != count; i++ )
+				if ( entries[ i ].offset != other.entries[ i ].offset || entries[ i ].digest != other.entries[ i ].digest )
+					return i;
+			return entries.size() == other.entries.size() ? npos : count;
+		}
+	};
+
+	// Computes the page hashes of a raw image, std::nullopt if the headers or sections do not fit the file.
+	// - Pages are hashed in contiguous batches across threads, number of threads defaults to the hardware concurrency.
+	//
+	template<typename H = sha256_t, bool x64>
+	inline std::optional<page_hash_table_t<H>> compute_page_hashes( const image_t<x64>* image, size_t file_size, size_t num_threads = 0 )
+	{
+		using table_t = page_hash_table_t<H>;
+		auto* base = ( const uint8_t* ) image;
+		auto* nt_hdrs = image->get_nt_headers();
+
+		struct range_t { size_t offset, length; };
+		std::vector<range_t> header_ranges;
+		if ( !for_each_authenticode_header_range( image, file_size, [ & ] ( size_t offset, size_t length ) { header_ranges.push_back( { offset, length } ); } ) )
+			return std::nullopt;
+		size_t size_headers = nt_hdrs->optional_header.size_headers;
+
+		// Lay out the entries, the digest is filled in by the workers.
+		//
+		table_t table = {};
+		std::vector<uint32_t> lengths;
+		table.entries.push_back( { 0, {} } );
+		lengths.push_back( uint32_t( size_headers ) );
+		uint32_t end_offset = uint32_t( size_headers );
+		for ( size_t i = 0; i != nt_hdrs->file_header.num_sections; i++ )
+		{
+			auto* scn = nt_hdrs->get_section( i );
+			if ( !scn->size_raw_data )
+				continue;
+			if ( scn->ptr_raw_data > file_size || scn->size_raw_data > ( file_size - scn->ptr_raw_data ) )
+				return std::nullopt;
+			for ( size_t offset = 0; offset < scn->size_raw_data; offset += page_hash_page_size )
+			{
+				table.entries.push_back( { uint32_t( scn->ptr_raw_data + offset ), {} } );
+				lengths.push_back( uint32_t( std::min<size_t>( page_hash_page_size, scn->size_raw_data - offset ) ) );
+			}
+			end_offset = scn->ptr_raw_data + scn->size_raw_data;
+		}
+		size_t num_pages = table.entries.size();
+		table.entries.push_back( { end_offset, {} } );
+
+		auto worker = [ & ] ( size_t begin, size_t end )
+		{
+			static constexpr uint8_t zeroes[ page_hash_page_size ] = {};
+			for ( size_t i = begin; i != end; i++ )
+			{
+				H hasher;
+				size_t length = lengths[ i ];
+				if ( i == 0 )
+				{
+					for ( auto& range : header_ranges )
+						hasher.update( base + range.offset, range.length );
+				}
+				else
+				{
+					hasher.update( base + table.entries[ i ].offset, length );
+				}
+				for ( size_t pad = ( page_hash_page_size - length % page_hash_page_size ) % page_hash_page_size; pad; )
+				{
+					size_t n = std::min( pad, page_hash_page_size );
+					hasher.update( zeroes, n );
+					pad -= n;
+				}
+				table.entries[ i ].digest = hasher.finalize();
+			}
+		};
+
+		if ( !num_threads )
+			num_threads = std::max<size_t>( std::thread::hardware_concurrency(), 1 );
+		num_threads = std::clamp<size_t>( num_pages / 64, 1, num_threads );
+
+		size_t chunk = ( num_pages + num_threads - 1 ) / num_threads;
+		std::vector<std::thread> threads;
+		for ( size_t n = 1; n < num_threads; n++ )
+			threads.emplace_back( worker, std::min( n * chunk, num_pages ), std::min( ( n + 1 ) * chunk, num_pages ) );
+		worker( 0, std::min( chunk, num_pages ) );
+		for ( auto& thread : threads )
+			thread.join();
+		return table;
+	}
+
+	// Recomputes the page hashes and returns the index of the first entry differing from the expected table,
+	// npos if all match and std::nullopt if the image is malformed.
+	//
+	template<typename H = sha256_t, bool x64>
+	inline std::optional<size_t> verify_page_hashes( const image_t<x64>* image, size_t file_size, const page_hash_table_t<H>& expected, size_t num_threads = 0 )
+	{
+		auto table = compute_page_hashes<H>( image, file_size, num_threads );
+		if ( !table )
+			return std::nullopt;
+		return table->find_mismatch( expected );
+	}
+};
@@ -0,0 +1,270 @@
+// Copyright (c) 2020 Can Boluk
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <cstring>
+#include <map>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "../img_common.hpp"
+#include "directories/dir_resource.hpp"
+#include "image.hpp"
+
+namespace win
+{
+	// Builder laying out a resource section from an in-memory tree.
+	// - Levels are sorted as the loader expects: names first in ordinal order, then identifiers ascending.
+	// - Layout is directories, data entries, deduplicated name strings and the 8-byte aligned data.
+	// - Data is not copied, the referenced memory must outlive the builder.
+	//
+	struct rsrc_builder_t
+	{
+		struct key_t
+		{
+			std::u16string          name = {};
+			uint16_t                id = 0;
+			bool                    is_named = false;
+
+			key_t() = default;
+			key_t( const rsrc_key_t& k ) : is_named( k.is_named() )
+			{
+				if ( is_named ) name = k.view();
+				else            id = k.value;
+			}
+			bool operator<( const key_t& o ) const
+			{
+				if ( is_named != o.is_named ) return is_named;
+				return is_named ? name < o.name : id < o.id;
+			}
+		};
+		struct data_t
+		{
+			std::span<const uint8_t> bytes = {};
+			uint32_t                code_page = 0;
+		};
+		using lang_map =            std::map<uint16_t, data_t>;
+		using name_map =            std::map<key_t, lang_map>;
+		using type_map =            std::map<key_t, name_map>;
+
+		type_map                    types = {};
+		uint32_t                    timedate_stamp = 0;
+
+		// Tree manipulation.
+		//
+		void add( const rsrc_key_t& type, const rsrc_key_t& name, uint16_t lang, std::span<const uint8_t> bytes, uint32_t code_page = 0 )
+		{
+			types[ type ][ name ][ lang ] = { bytes, code_page };
+		}
+		bool remove( const rsrc_key_t& type, const rsrc_key_t& name, uint16_t lang )
+		{
+			auto t = types.find( type );
+			if ( t == types.end() ) return false;
+			auto n = t->second.find( name );
+			if ( n == t->second.end() || !n->second.erase( lang ) ) return false;
+			if ( n->second.empty() ) t->second.erase( n );
+			if ( t->second.empty() ) types.erase( t );
+			return true;
+		}
+		bool remove( const rsrc_key_t& type ) { return types.erase( type ) != 0; }
+
+		// Imports the resources of an image, entries with data out of the image are skipped.
+		//
+		template<bool x64>
+		static rsrc_builder_t from_image( const image_t<x64>* image )
+		{
+			rsrc_builder_t builder = {};
+			auto* dir = image->get_directory( directory_entry_resource );
+			if ( !dir || !dir->present() )
+				return builder;
+			auto* rsrc = image->template rva_to_ptr<resource_directory_t>( dir->rva, dir->size );
+			for ( auto& e : rsrc_index_t::build( rsrc, rsrc ? dir->size : 0 ).entries )
+			{
+				auto* bytes = image->template rva_to_ptr<uint8_t>( e.data->rva_data, e.data->size_data );
+				if ( bytes || !e.data->size_data )
+					builder.add( e.type, e.name, e.lang, { bytes, e.data->size_data }, e.data->code_page );
+			}
+			return builder;
+		}
+
+		// Exact size of the serialized section.
+		//
+		struct layout_t
+		{
+			uint32_t                directories = 0;   // Size of all directories.
+			uint32_t                type_level = 0;    // Offset of the directories listing the names of each type.
+			uint32_t                name_level = 0;    // Offset of the directories listing the languages of each name.
+			uint32_t                data_entries = 0;  // Offset of the rsrc_data_t array.
+			uint32_t                strings = 0;       // Offset of the name strings.
+			uint32_t                data = 0;          // Offset of the raw data.
+			uint32_t                size = 0;
+		};
+		layout_t layout() const
+		{
+			layout_t l = {};
+			size_t num_leaves = 0;
+			std::map<std::u16string_view, bool> strings;
+			l.type_level = directory_size( types.size() );
+			l.name_level = l.type_level;
+			l.data_entries = l.type_level;
+			for ( auto& [ type, names ] : types )
+			{
+				l.name_level += directory_size( names.size() );
+				l.data_entries += directory_size( names.size() );
+				if ( type.is_named ) strings[ type.name ];
+				for ( auto& [ name, langs ] : names )
+				{
+					l.data_entries += directory_size( langs.size() );
+					if ( name.is_named ) strings[ name.name ];
+					num_leaves += langs.size();
+					for ( auto& [ lang, data ] : langs )
+						l.size += align_up( data.bytes.size() );
+				}
+			}
+			l.directories = l.data_entries;
+			l.strings = uint32_t( l.data_entries + num_leaves * sizeof( rsrc_data_t ) );
+			l.data = l.strings;
+			for ( auto& [ str, _ ] : strings )
+				l.data += uint32_t( sizeof( uint16_t ) + str.size() * sizeof( char16_t ) );
+			l.data = align_up( l.data );
+			l.size += l.data;
+			return l;
+		}
+		size_t size() const { return layout().size; }
+
+		// Serializes the section for the given RVA into the buffer, returns false if it is too small.
+		//
+		bool write( void* out, size_t capacity, uint32_t section_rva ) const { return write( out, capacity, section_rva, layout() ); }
+		bool write( void* out, size_t capacity, uint32_t section_rva, const layout_t& l ) const
+		{
+			if ( capacity < l.size )
+				return false;
+			auto* base = ( uint8_t* ) out;
+			memset( base, 0, l.size );
+
+			uint32_t type_cursor = l.type_level;
+			uint32_t name_cursor = l.name_level;
+			uint32_t entry_cursor = l.data_entries;
+			uint32_t string_cursor = l.strings;
+			uint32_t data_cursor = l.data;
+			std::map<std::u16string_view, uint32_t> string_offsets;
+
+			auto write_directory = [ & ] ( uint32_t offset, const auto& map )
+			{
+				auto* dir = ( rsrc_directory_t* ) ( base + offset );
+				dir->timedate_stamp = timedate_stamp;
+				for ( auto& [ key, _ ] : map )
+				{
+					if constexpr ( std::is_same_v<std::decay_t<decltype( key )>, key_t> )
+					{
+						if ( key.is_named ) dir->num_named_entries++;
+						else                dir->num_id_entries++;
+					}
+					else
+					{
+						dir->num_id_entries++;
+					}
+				}
+				return dir;
+			};
+			auto set_key = [ & ] ( rsrc_generic_t& entry, const key_t& key )
+			{
+				if ( !key.is_named )
+				{
+					entry.identifier = key.id;
+					return;
+				}
+				auto [ it, inserted ] = string_offsets.emplace( key.name, string_cursor );
+				if ( inserted )
+				{
+					uint16_t length = uint16_t( key.name.size() );
+					memcpy( base + string_cursor, &length, sizeof( length ) );
+					memcpy( base + string_cursor + sizeof( length ), key.name.data(), length * sizeof( char16_t ) );
+					string_cursor += sizeof( length ) + length * sizeof( char16_t );
+				}
+				entry.offset_name = it->second;
+				entry.is_named = 1;
+			};
+
+			auto* root = write_directory( 0, types );
+			size_t type_index = 0;
+			for ( auto& [ type, names ] : types )
+			{
+				auto& te = root->entries[ type_index++ ];
+				set_key( te, type );
+				te.offset = type_cursor;
+				te.is_directory = 1;
+
+				auto* type_dir = write_directory( type_cursor, names );
+				type_cursor += directory_size( names.size() );
+
+				size_t name_index = 0;
+				for ( auto& [ name, langs ] : names )
+				{
+					auto& ne = type_dir->entries[ name_index++ ];
+					set_key( ne, name );
+					ne.offset = name_cursor;
+					ne.is_directory = 1;
+
+					auto* name_dir = write_directory( name_cursor, langs );
+					name_cursor += directory_size( langs.size() );
+
+					size_t lang_index = 0;
+					for ( auto& [ lang, data ] : langs )
+					{
+						auto& le = name_dir->entries[ lang_index++ ];
+						le.identifier = lang;
+						le.offset = entry_cursor;
+
+						auto* entry = ( rsrc_data_t* ) ( base + entry_cursor );
+						entry->rva_data = section_rva + data_cursor;
+						entry->size_data = uint32_t( data.bytes.size() );
+						entry->code_page = data.code_page;
+						entry_cursor += sizeof( rsrc_data_t );
+
+						if ( !data.bytes.empty() )
+							memcpy( base + data_cursor, data.bytes.data(), data.bytes.size() );
+						data_cursor += align_up( data.bytes.size() );
+					}
+				}
+			}
+			return true;
+		}
+		std::vector<uint8_t> build( uint32_t section_rva ) const
+		{
+			auto l = layout();
+			std::vector<uint8_t> result( l.size );
+			write( result.data(), result.size(), section_rva, l );
+			return result;
+		}
+
+	private:
+		static constexpr uint32_t align_up( size_t n ) { return uint32_t( ( n + 7 ) & ~size_t( 7 ) ); }
+		static constexpr uint32_t directory_size( size_t n ) { return uint32_t( offsetof( rsrc_directory_t, entries ) + n * sizeof( rsrc_generic_t ) ); }
+	};
+};
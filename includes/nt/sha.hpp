@@ -0,0 +1,291 @@
+// Copyright (c) 2020 Can Boluk
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include "../img_common.hpp"
+
+#if defined( _MSC_VER ) && ( defined( _M_X64 ) || defined( _M_IX86 ) )
+	#include <intrin.h>
+	#include <immintrin.h>
+	#define WIN_SHA_NI 1
+	#define WIN_SHA_NI_TARGET
+#elif ( defined( __GNUC__ ) || defined( __clang__ ) ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+	#include <cpuid.h>
+	#include <immintrin.h>
+	#define WIN_SHA_NI 1
+	#define WIN_SHA_NI_TARGET __attribute__(( target( "sha,sse4.1,ssse3" ) ))
+#endif
+
+// Self contained SHA-1 and SHA-256 used for image digests.
+// - SHA-256 uses the SHA extensions if the processor reports them, detected once at runtime.
+//
+namespace win
+{
+	namespace impl
+	{
+		inline constexpr uint32_t sha256_k[ 64 ] = {
+			0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+			0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+			0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+			0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+			0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+			0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+			0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+			0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+		};
+
+		inline uint32_t load_be32( const uint8_t* p ) { return ( uint32_t( p[ 0 ] ) << 24 ) | ( uint32_t( p[ 1 ] ) << 16 ) | ( uint32_t( p[ 2 ] ) << 8 ) | p[ 3 ]; }
+		inline void store_be32( uint8_t* p, uint32_t v ) { p[ 0 ] = uint8_t( v >> 24 ); p[ 1 ] = uint8_t( v >> 16 ); p[ 2 ] = uint8_t( v >> 8 ); p[ 3 ] = uint8_t( v ); }
+
+		// Portable block functions.
+		//
+		inline void sha256_blocks_generic( uint32_t* state, const uint8_t* data, size_t blocks )
+		{
+			for ( ; blocks; blocks--, data += 64 )
+			{
+				uint32_t w[ 64 ];
+				for ( size_t i = 0; i != 16; i++ )
+					w[ i ] = load_be32( data + i * 4 );
+				for ( size_t i = 16; i != 64; i++ )
+				{
+					uint32_t s0 = std::rotr( w[ i - 15 ], 7 ) ^ std::rotr( w[ i - 15 ], 18 ) ^ ( w[ i - 15 ] >> 3 );
+					uint32_t s1 = std::rotr( w[ i - 2 ], 17 ) ^ std::rotr( w[ i - 2 ], 19 ) ^ ( w[ i - 2 ] >> 10 );
+					w[ i ] = w[ i - 16 ] + s0 + w[ i - 7 ] + s1;
+				}
+
+				uint32_t a = state[ 0 ], b = state[ 1 ], c = state[ 2 ], d = state[ 3 ];
+				uint32_t e = state[ 4 ], f = state[ 5 ], g = state[ 6 ], h = state[ 7 ];
+				for ( size_t i = 0; i != 64; i++ )
+				{
+					uint32_t t1 = h + ( std::rotr( e, 6 ) ^ std::rotr( e, 11 ) ^ std::rotr( e, 25 ) ) + ( ( e & f ) ^ ( ~e & g ) ) + sha256_k[ i ] + w[ i ];
+					uint32_t t2 = ( std::rotr( a, 2 ) ^ std::rotr( a, 13 ) ^ std::rotr( a, 22 ) ) + ( ( a & b ) ^ ( a & c ) ^ ( b & c ) );
+					h = g; g = f; f = e; e = d + t1;
+					d = c; c = b; b = a; a = t1 + t2;
+				}
+				state[ 0 ] += a; state[ 1 ] += b; state[ 2 ] += c; state[ 3 ] += d;
+				state[ 4 ] += e; state[ 5 ] += f; state[ 6 ] += g; state[ 7 ] += h;
+			}
+		}
+		inline void sha1_blocks_generic( uint32_t* state, const uint8_t* data, size_t blocks )
+		{
+			for ( ; blocks; blocks--, data += 64 )
+			{
+				uint32_t w[ 80 ];
+				for ( size_t i = 0; i != 16; i++ )
+					w[ i ] = load_be32( data + i * 4 );
+				for ( size_t i = 16; i != 80; i++ )
+					w[ i ] = std::rotl( w[ i - 3 ] ^ w[ i - 8 ] ^ w[ i - 14 ] ^ w[ i - 16 ], 1 );
+
+				uint32_t a = state[ 0 ], b = state[ 1 ], c = state[ 2 ], d = state[ 3 ], e = state[ 4 ];
+				for ( size_t i = 0; i != 80; i++ )
+				{
+					uint32_t f, k;
+					if ( i < 20 )      f = ( b & c ) | ( ~b & d ),           k = 0x5A827999;
+					else if ( i < 40 ) f = b ^ c ^ d,                        k = 0x6ED9EBA1;
+					else if ( i < 60 ) f = ( b & c ) | ( b & d ) | ( c & d ), k = 0x8F1BBCDC;
+					else               f = b ^ c ^ d,                        k = 0xCA62C1D6;
+					uint32_t t = std::rotl( a, 5 ) + f + e + k + w[ i ];
+					e = d; d = c; c = std::rotl( b, 30 ); b = a; a = t;
+				}
+				state[ 0 ] += a; state[ 1 ] += b; state[ 2 ] += c; state[ 3 ] += d; state[ 4 ] += e;
+			}
+		}
+
+#if WIN_SHA_NI
+		// SHA extension block function.
+		//
+		WIN_SHA_NI_TARGET
+		inline void sha256_blocks_shani( uint32_t* state, const uint8_t* data, size_t blocks )
+		{
+			const __m128i mask = _mm_set_epi64x( 0x0c0d0e0f08090a0bull, 0x0405060700010203ull );
+
+			// Reorder the state into ABEF/CDGH.
+			//
+			__m128i tmp = _mm_shuffle_epi32( _mm_loadu_si128( ( const __m128i* ) &state[ 0 ] ), 0xB1 );
+			__m128i state1 = _mm_shuffle_epi32( _mm_loadu_si128( ( const __m128i* ) &state[ 4 ] ), 0x1B );
+			__m128i state0 = _mm_alignr_epi8( tmp, state1, 8 );
+			state1 = _mm_blend_epi16( state1, tmp, 0xF0 );
+
+			for ( ; blocks; blocks--, data += 64 )
+			{
+				__m128i abef = state0, cdgh = state1;
+				__m128i w[ 4 ];
+				for ( size_t g = 0; g != 16; g++ )
+				{
+					if ( g < 4 )
+						w[ g ] = _mm_shuffle_epi8( _mm_loadu_si128( ( const __m128i* ) ( data + g * 16 ) ), mask );
+
+					__m128i msg = _mm_add_epi32( w[ g % 4 ], _mm_loadu_si128( ( const __m128i* ) &sha256_k[ g * 4 ] ) );
+					state1 = _mm_sha256rnds2_epu32( state1, state0, msg );
+					if ( 3 <= g && g <= 14 )
+					{
+						__m128i& next = w[ ( g + 1 ) % 4 ];
+						next = _mm_add_epi32( next, _mm_alignr_epi8( w[ g % 4 ], w[ ( g + 3 ) % 4 ], 4 ) );
+						next = _mm_sha256msg2_epu32( next, w[ g % 4 ] );
+					}
+					state0 = _mm_sha256rnds2_epu32( state0, state1, _mm_shuffle_epi32( msg, 0x0E ) );
+					if ( 1 <= g && g <= 12 )
+						w[ ( g + 3 ) % 4 ] = _mm_sha256msg1_epu32( w[ ( g + 3 ) % 4 ], w[ g % 4 ] );
+				}
+				state0 = _mm_add_epi32( state0, abef );
+				state1 = _mm_add_epi32( state1, cdgh );
+			}
+
+			// Restore the linear order.
+			//
+			tmp = _mm_shuffle_epi32( state0, 0x1B );
+			state1 = _mm_shuffle_epi32( state1, 0xB1 );
+			_mm_storeu_si128( ( __m128i* ) &state[ 0 ], _mm_blend_epi16( tmp, state1, 0xF0 ) );
+			_mm_storeu_si128( ( __m128i* ) &state[ 4 ], _mm_alignr_epi8( state1, tmp, 8 ) );
+		}
+		inline bool cpu_has_sha_ni()
+		{
+			static const bool result = [ ] ()
+			{
+#if defined( _MSC_VER )
+				int regs[ 4 ];
+				__cpuid( regs, 0 );
+				if ( regs[ 0 ] < 7 ) return false;
+				__cpuid( regs, 1 );
+				uint32_t ecx1 = uint32_t( regs[ 2 ] );
+				__cpuidex( regs, 7, 0 );
+				uint32_t ebx7 = uint32_t( regs[ 1 ] );
+#else
+				unsigned eax, ebx, ecx, edx;
+				if ( __get_cpuid_max( 0, nullptr ) < 7 ) return false;
+				__cpuid( 1, eax, ebx, ecx, edx );
+				uint32_t ecx1 = ecx;
+				__cpuid_count( 7, 0, eax, ebx, ecx, edx );
+				uint32_t ebx7 = ebx;
+#endif
+				bool ssse3 = ecx1 & ( 1 << 9 );
+				bool sse41 = ecx1 & ( 1 << 19 );
+				bool sha = ebx7 & ( 1 << 29 );
+				return ssse3 && sse41 && sha;
+			}();
+			return result;
+		}
+#endif
+
+		// Merkle-Damgard framing shared by both hashes.
+		//
+		template<size_t N, size_t D, auto Blocks>
+		struct md_hash_t
+		{
+			uint32_t                state[ N ];
+			uint64_t                length = 0;
+			uint8_t                 buffer[ 64 ] = {};
+			size_t                  buffered = 0;
+
+			void process( const uint8_t* data, size_t blocks ) { Blocks( state, data, blocks ); }
+
+			void update( const void* data, size_t size )
+			{
+				auto* it = ( const uint8_t* ) data;
+				length += size;
+				if ( buffered )
+				{
+					size_t n = std::min( size, 64 - buffered );
+					memcpy( buffer + buffered, it, n );
+					buffered += n;
+					it += n;
+					size -= n;
+					if ( buffered != 64 )
+						return;
+					process( buffer, 1 );
+					buffered = 0;
+				}
+				if ( size >= 64 )
+				{
+					process( it, size / 64 );
+					it += size & ~size_t( 63 );
+					size &= 63;
+				}
+				if ( size )
+				{
+					memcpy( buffer, it, size );
+					buffered = size;
+				}
+			}
+
+			std::array<uint8_t, D> finalize()
+			{
+				uint64_t bits = length * 8;
+				uint8_t pad[ 72 ] = { 0x80 };
+				size_t pad_length = ( buffered < 56 ? 56 : 120 ) - buffered;
+				for ( size_t i = 0; i != 8; i++ )
+					pad[ pad_length + i ] = uint8_t( bits >> ( 56 - i * 8 ) );
+				update( pad, pad_length + 8 );
+
+				std::array<uint8_t, D> digest;
+				for ( size_t i = 0; i != D / 4; i++ )
+					store_be32( digest.data() + i * 4, state[ i ] );
+				return digest;
+			}
+		};
+
+		inline void sha256_blocks( uint32_t* state, const uint8_t* data, size_t blocks )
+		{
+#if WIN_SHA_NI
+			if ( cpu_has_sha_ni() )
+				return sha256_blocks_shani( state, data, blocks );
+#endif
+			sha256_blocks_generic( state, data, blocks );
+		}
+	};
+
+	// Streaming hashes.
+	//
+	struct sha256_t : impl::md_hash_t<8, 32, impl::sha256_blocks>
+	{
+		using digest_t = std::array<uint8_t, 32>;
+		sha256_t() : md_hash_t{ { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 } } {}
+
+		static digest_t hash( const void* data, size_t size )
+		{
+			sha256_t h;
+			h.update( data, size );
+			return h.finalize();
+		}
+	};
+	struct sha1_t : impl::md_hash_t<5, 20, impl::sha1_blocks_generic>
+	{
+		using digest_t = std::array<uint8_t, 20>;
+		sha1_t() : md_hash_t{ { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 } } {}
+
+		static digest_t hash( const void* data, size_t size )
+		{
+			sha1_t h;
+			h.update( data, size );
+			return h.finalize();
+		}
+	};
+};
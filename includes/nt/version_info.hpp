@@ -0,0 +1,388 @@
+// Copyright (c) 2020 Can Boluk
+// All rights reserved.   
+//    
+// Redistribution and use in source and binary forms, with or without   
+// modification, are permitted provided that the following conditions are met: 
+//    
+// 1. Redistributions of source code must retain the above copyright notice,   
+//    this list of conditions and the following disclaimer.   
+// 2. Redistributions in binary form must reproduce the above copyright   
+//    notice, this list of conditions and the following disclaimer in the   
+//    documentation and/or other materials provided with the distribution.   
+// 3. Neither the name of the copyright holder nor the names of its contributors
+//    may be used to endorse or promote products derived from this software 
+//    without specific prior written permission.   
+//    
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" 
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE   
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE  
+// ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE   
+// LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR   
+// CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF   
+// SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS   
+// INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN   
+// CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)   
+// ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE  
+// POSSIBILITY OF SUCH DAMAGE.        
+//
+#pragma once
+#include <algorithm>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <string_view>
+#if defined( __SSE2__ ) || defined( _M_X64 ) || defined( _M_AMD64 )
+	#include <emmintrin.h>
+	#define WIN_UTF16_SSE2 1
+#endif
+#include "../img_common.hpp"
+#include "directories/dir_resource.hpp"
+#include "image.hpp"
+
+// Resource payload formats for resource_id::version and resource_id::string.
+// - Strings are exposed as std::u16string_view into the image since wchar_t is not 16-bit on every platform.
+//
+WIN_STRUCT_PACKING
+namespace win
+{
+	static constexpr uint32_t vs_fixed_file_info_signature = 0xFEEF04BD;
+
+	// File flags, OS and type of VS_FIXEDFILEINFO.
+	//
+	enum vs_file_flags_t : uint32_t
+	{
+		vs_ff_debug =                0x01,
+		vs_ff_prerelease =           0x02,
+		vs_ff_patched =              0x04,
+		vs_ff_privatebuild =         0x08,
+		vs_ff_infoinferred =         0x10,
+		vs_ff_specialbuild =         0x20,
+	};
+	enum class vs_file_type_t : uint32_t
+	{
+		unknown =                    0x0,
+		app =                        0x1,
+		dll =                        0x2,
+		drv =                        0x3,
+		font =                       0x4,
+		vxd =                        0x5,
+		static_lib =                 0x7,
+	};
+
+	// Fixed file information.
+	//
+	struct vs_fixed_file_info_t
+	{
+		uint32_t                    signature;
+		uint32_t                    struct_version;
+		uint32_t                    file_version_ms;
+		uint32_t                    file_version_ls;
+		uint32_t                    product_version_ms;
+		uint32_t                    product_version_ls;
+		uint32_t                    file_flags_mask;
+		uint32_t                    file_flags;
+		uint32_t                    file_os;
+		vs_file_type_t              file_type;
+		uint32_t                    file_subtype;
+		uint32_t                    file_date_ms;
+		uint32_t                    file_date_ls;
+
+		// Versions as 64-bit integers, major version in the highest word.
+		//
+		inline uint64_t file_version() const { return ( uint64_t( file_version_ms ) << 32 ) | file_version_ls; }
+		inline uint64_t product_version() const { return ( uint64_t( product_version_ms ) << 32 ) | product_version_ls; }
+	};
+
+	// Block header shared by every node of the version resource.
+	//
+	struct vs_block_header_t
+	{
+		uint16_t                    length;
+		uint16_t                    value_length;    // In code units if text.
+		uint16_t                    type;            // 1 if text, 0 if binary.
+	};
+};
+#pragma pack(pop)
+
+namespace win
+{
+	// View of a version resource node, validated against the bounds of its parent.
+	//
+	struct version_block_t
+	{
+		const uint8_t*              base = nullptr;
+		size_t                      length = 0;
+		std::u16string_view         key = {};
+		const void*                 value = nullptr;
+		size_t                      value_size = 0;   // In bytes.
+		bool                        is_text = false;
+		size_t                      children_offset = 0;
+
+		// Parses the block at the given pointer, returns std::nullopt if malformed.
+		//
+		static std::optional<version_block_t> parse( const void* data, size_t size )
+		{
+			if ( size < sizeof( vs_block_header_t ) )
+				return std::nullopt;
+			auto* hdr = ( const vs_block_header_t* ) data;
+			if ( hdr->length < sizeof( vs_block_header_t ) || hdr->length > size )
+				return std::nullopt;
+
+			version_block_t block = {};
+			block.base = ( const uint8_t* ) data;
+			block.length = hdr->length;
+			block.is_text = hdr->type == 1;
+
+			// Null terminated key.
+			//
+			auto* key = ( const char16_t* ) ( block.base + sizeof( vs_block_header_t ) );
+			size_t max_key = ( block.length - sizeof( vs_block_header_t ) ) / sizeof( char16_t );
+			size_t key_length = 0;
+			while ( key_length != max_key && key[ key_length ] )
+				key_length++;
+			if ( key_length == max_key )
+				return std::nullopt;
+			block.key = { key, key_length };
+
+			// Value aligned to 4 bytes, clamped to the block.
+			//
+			size_t value_offset = align_up( sizeof( vs_block_header_t ) + ( key_length + 1 ) * sizeof( char16_t ) );
+			size_t value_size = hdr->value_length * ( block.is_text ? sizeof( char16_t ) : 1 );
+			if ( value_offset > block.length )
+				value_offset = block.length;
+			value_size = std::min( value_size, block.length - value_offset );
+			block.value = block.base + value_offset;
+			block.value_size = value_size;
+			block.children_offset = std::min( align_up( value_offset + value_size ), block.length );
+			return block;
+		}
+
+		// Text value without the terminators.
+		//
+		inline std::u16string_view text() const
+		{
+			std::u16string_view result{ ( const char16_t* ) value, value_size / sizeof( char16_t ) };
+			while ( !result.empty() && !result.back() )
+				result.remove_suffix( 1 );
+			return result;
+		}
+
+		// Enumerates the children, stops at the first malformed one.
+		//
+		template<typename F>
+		void for_each_child( F&& fn ) const
+		{
+			size_t offset = children_offset;
+			while ( offset + sizeof( vs_block_header_t ) <= length )
+			{
+				auto child = parse( base + offset, length - offset );
+				if ( !child )
+					break;
+				fn( *child );
+				offset += align_up( child->length );
+			}
+		}
+		inline std::optional<version_block_t> find_child( std::u16string_view name ) const
+		{
+			std::optional<version_block_t> result = {};
+			for_each_child( [ & ] ( const version_block_t& child ) { if ( !result && child.key == name ) result = child; } );
+			return result;
+		}
+
+		static constexpr size_t align_up( size_t n ) { return ( n + 3 ) & ~size_t( 3 ); }
+	};
+
+	// VS_VERSIONINFO root.
+	//
+	struct version_info_t
+	{
+		version_block_t             root = {};
+		const vs_fixed_file_info_t* fixed = nullptr;
+
+		// Parses the resource data, returns std::nullopt if it is not a version resource.
+		//
+		static std::optional<version_info_t> parse( const void* data, size_t size )
+		{
+			auto root = version_block_t::parse( data, size );
+			if ( !root || root->key != u"VS_VERSION_INFO" )
+				return std::nullopt;
+
+			version_info_t info = { *root };
+			if ( root->value_size >= sizeof( vs_fixed_file_info_t ) )
+			{
+				auto* fixed = ( const vs_fixed_file_info_t* ) root->value;
+				if ( fixed->signature == vs_fixed_file_info_signature )
+					info.fixed = fixed;
+			}
+			return info;
+		}
+		template<bool x64>
+		static std::optional<version_info_t> parse( const image_t<x64>* image, const rsrc_data_t* data )
+		{
+			if ( !data )
+				return std::nullopt;
+			auto* ptr = image->template rva_to_ptr<uint8_t>( data->rva_data, data->size_data );
+			return ptr ? parse( ptr, data->size_data ) : std::nullopt;
+		}
+
+		// Enumerates StringFileInfo entries as fn( table, key, value ) where table is the language and code page, e.g. "040904B0".
+		//
+		template<typename F>
+		void for_each_string( F&& fn ) const
+		{
+			root.for_each_child( [ & ] ( const version_block_t& info )
+			{
+				if ( info.key != u"StringFileInfo" )
+					return;
+				info.for_each_child( [ & ] ( const version_block_t& table )
+				{
+					table.for_each_child( [ & ] ( const version_block_t& string )
+					{
+						fn( table.key, string.key, string.text() );
+					} );
+				} );
+			} );
+		}
+
+		// Finds a string value, within the given table if not empty.
+		//
+		std::optional<std::u16string_view> find_string( std::u16string_view key, std::u16string_view table = {} ) const
+		{
+			std::optional<std::u16string_view> result = {};
+			for_each_string( [ & ] ( std::u16string_view t, std::u16string_view k, std::u16string_view v )
+			{
+				if ( !result && k == key && ( table.empty() || t == table ) )
+					result = v;
+			} );
+			return result;
+		}
+
+		// VarFileInfo\Translation entries, language in the low word and code page in the high word.
+		//
+		std::span<const uint32_t> translations() const
+		{
+			std::span<const uint32_t> result = {};
+			root.for_each_child( [ & ] ( const version_block_t& info )
+			{
+				if ( info.key != u"VarFileInfo" )
+					return;
+				if ( auto var = info.find_child( u"Translation" ) )
+					result = { ( const uint32_t* ) var->value, var->value_size / sizeof( uint32_t ) };
+			} );
+			return result;
+		}
+	};
+
+	// RT_STRING block holding 16 length-prefixed strings.
+	// - String n is stored in block ( n / 16 ) + 1 at index n % 16.
+	//
+	struct string_table_block_t
+	{
+		const uint8_t*              data = nullptr;
+		size_t                      size = 0;
+
+		static constexpr uint16_t block_id( uint16_t string_id ) { return uint16_t( ( string_id >> 4 ) + 1 ); }
+		static constexpr size_t block_index( uint16_t string_id ) { return string_id & 15; }
+
+		template<bool x64>
+		static string_table_block_t from( const image_t<x64>* image, const rsrc_data_t* entry )
+		{
+			if ( !entry )
+				return {};
+			return { image->template rva_to_ptr<uint8_t>( entry->rva_data, entry->size_data ), entry->size_data };
+		}
+
+		// Returns the string at the index, empty if not present or out of bounds.
+		//
+		std::u16string_view at( size_t index ) const
+		{
+			size_t offset = 0;
+			for ( size_t n = 0; data && n != 16; n++ )
+			{
+				if ( offset + sizeof( uint16_t ) > size )
+					break;
+				uint16_t length;
+				memcpy( &length, data + offset, sizeof( uint16_t ) );
+				offset += sizeof( uint16_t );
+				if ( ( size - offset ) / sizeof( char16_t ) < length )
+					break;
+				if ( n == index )
+					return { ( const char16_t* ) ( data + offset ), length };
+				offset += length * sizeof( char16_t );
+			}
+			return {};
+		}
+		std::u16string_view operator[]( size_t index ) const { return at( index ); }
+	};
+
+	// Transcodes UTF-16 into UTF-8 with unpaired surrogates replaced by U+FFFD.
+	// - Writes as many whole code points as fit into the buffer and returns the size required for the entire string.
+	// - ASCII runs are converted 8 code units at a time where SSE2 is available.
+	//
+	inline size_t utf16_to_utf8( std::u16string_view in, char* out, size_t capacity )
+	{
+		size_t required = 0;
+		bool   full = false;
+		size_t i = 0;
+		while ( i != in.size() )
+		{
+#if WIN_UTF16_SSE2
+			if ( !full && ( in.size() - i ) >= 8 && ( capacity - required ) >= 8 )
+			{
+				__m128i units = _mm_loadu_si128( ( const __m128i* ) ( in.data() + i ) );
+				__m128i high = _mm_and_si128( units, _mm_set1_epi16( int16_t( 0xFF80 ) ) );
+				if ( _mm_movemask_epi8( _mm_cmpeq_epi16( high, _mm_setzero_si128() ) ) == 0xFFFF )
+				{
+					_mm_storel_epi64( ( __m128i* ) ( out + required ), _mm_packus_epi16( units, units ) );
+					required += 8;
+					i += 8;
+					continue;
+				}
+			}
+#endif
+			// Decode a single code point.
+			//
+			uint32_t cp = in[ i++ ];
+			if ( 0xD800 <= cp && cp <= 0xDBFF && i != in.size() && 0xDC00 <= in[ i ] && in[ i ] <= 0xDFFF )
+				cp = 0x10000 + ( ( cp - 0xD800 ) << 10 ) + ( in[ i++ ] - 0xDC00 );
+			else if ( 0xD800 <= cp && cp <= 0xDFFF )
+				cp = 0xFFFD;
+
+			char   buffer[ 4 ];
+			size_t length;
+			if ( cp < 0x80 )
+			{
+				buffer[ 0 ] = char( cp );
+				length = 1;
+			}
+			else if ( cp < 0x800 )
+			{
+				buffer[ 0 ] = char( 0xC0 | ( cp >> 6 ) );
+				buffer[ 1 ] = char( 0x80 | ( cp & 0x3F ) );
+				length = 2;
+			}
+			else if ( cp < 0x10000 )
+			{
+				buffer[ 0 ] = char( 0xE0 | ( cp >> 12 ) );
+				buffer[ 1 ] = char( 0x80 | ( ( cp >> 6 ) & 0x3F ) );
+				buffer[ 2 ] = char( 0x80 | ( cp & 0x3F ) );
+				length = 3;
+			}
+			else
+			{
+				buffer[ 0 ] = char( 0xF0 | ( cp >> 18 ) );
+				buffer[ 1 ] = char( 0x80 | ( ( cp >> 12 ) & 0x3F ) );
+				buffer[ 2 ] = char( 0x80 | ( ( cp >> 6 ) & 0x3F ) );
+				buffer[ 3 ] = char( 0x80 | ( cp & 0x3F ) );
+				length = 4;
+			}
+
+			full = full || ( capacity - required ) < length;
+			if ( !full )
+				memcpy( out + required, buffer, length );
+			required += length;
+		}
+		return required;
+	}
+};
+#undef WIN_UTF16_SSE2